@@ -3,28 +3,144 @@
 #include "Object.h"
 #include "Extensions.h"
 #include "Device.h"
+#include "ScratchArena.h"
+#include "GpuProfiler.h"
+
+#include <functional>
 
 namespace scatter {
 
+// Both structures are described with the VK_NV_ray_tracing create info. When VK_KHR_acceleration_structure is enabled
+// that description is translated to KHR build info, and the structure lives in a buffer of its own.
 struct BottomLevelAS {
     uint64_t handle;
     VmaAllocation alloc;
     VmaAllocationInfo allocInfo;
-    VkAccelerationStructureNV as;
+    VkAccelerationStructureNV as = VK_NULL_HANDLE;
+
+    // KHR only, the build sizes are known when the structure is created
+    VkAccelerationStructureKHR asKHR = VK_NULL_HANDLE;
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceSize scratchSize = 0;
+    VkDeviceSize updateScratchSize = 0;
 
     void init(VkDevice device, VmaAllocator allocator, VkAccelerationStructureCreateInfoNV* createInfo);
-    void record(VulkanDevice& device, VkAccelerationStructureCreateInfoNV* createInfo);
+    void record(VulkanDevice& device, VkAccelerationStructureCreateInfoNV* createInfo, ScratchArena& scratch);
+    void build(VkDevice device, VkCommandBuffer cmdBuffer, VkAccelerationStructureCreateInfoNV* createInfo, VkBuffer scratchBuffer, VkDeviceSize scratchOffset);
+    void update(VkDevice device, VkCommandBuffer cmdBuffer, VkAccelerationStructureCreateInfoNV* createInfo, VkBuffer scratchBuffer, VkDeviceSize scratchOffset);
+    void copy(VkCommandBuffer cmdBuffer, const BottomLevelAS& src, VkCopyAccelerationStructureModeNV mode);
     void destroy(VkDevice device, VmaAllocator allocator);
+
+    // KHR only, copies the structure to and from the driver's serialized format
+    void serialize(VkCommandBuffer cmdBuffer, VkDeviceAddress dst) const;
+    void deserialize(VkCommandBuffer cmdBuffer, VkDeviceAddress src);
+
+    VkDeviceSize getScratchSize(VkDevice device);
+    VkDeviceSize getUpdateScratchSize(VkDevice device);
+
+    // writes a size query (compacted or serialization) per structure, starting at the first query of queryPool
+    static void writeProperties(VkCommandBuffer cmdBuffer, const std::vector<const BottomLevelAS*>& structures, VkQueryType queryType, VkQueryPool queryPool);
+    static VkQueryType getCompactedSizeQueryType();
 };
 
 struct TopLevelAS {
-    VmaAllocation alloc;
+
+    struct InstanceBuffer {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VmaAllocation alloc = VK_NULL_HANDLE;
+        VkAccelerationStructureInstanceNV* instances = nullptr;
+        uint32_t capacity = 0;
+    };
+
+    struct InstanceSlot {
+        // the instance map writes to the slot of the next build directly
+        InstanceBuffer storage;
+
+        // only used while instances are left out of the build, see record
+        InstanceBuffer filtered;
+
+        // the buffer the last build of this slot read, refits read it again
+        VkBuffer input = VK_NULL_HANDLE;
+
+        // range of instances that changed while other slots were written
+        uint32_t dirtyBegin = UINT32_MAX;
+        uint32_t dirtyEnd = 0;
+
+        // range of the storage written by the host since the last build, flushed by record as the memory may not be coherent
+        uint32_t writtenBegin = UINT32_MAX;
+        uint32_t writtenEnd = 0;
+
+        VkFence fence = VK_NULL_HANDLE;
+        VkCommandBuffer cmdBuffer = VK_NULL_HANDLE;
+        bool pending = false;
+
+        // the last frame that refit from the input, the fence doesn't cover it
+        uint64_t readFrame = 0;
+    };
+
+    // frames are numbered by the owner. The wait blocks until a frame has finished,
+    // release frees an instance buffer once the frames that may still read it have
+    using FrameWait = std::function<void(uint64_t frame)>;
+    using BufferRelease = std::function<void(VkBuffer buffer, VmaAllocation alloc)>;
+
+    VmaAllocation alloc = VK_NULL_HANDLE;
     VmaAllocationInfo allocInfo;
     VkAccelerationStructureNV as = nullptr;
 
+    // KHR only, see BottomLevelAS
+    VkAccelerationStructureKHR asKHR = VK_NULL_HANDLE;
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceSize scratchSize = 0;
+    VkDeviceSize updateScratchSize = 0;
+
+    bool isBuilt() const { return alloc != VK_NULL_HANDLE; }
+
     void init(VkDevice device, VmaAllocator allocator, VkAccelerationStructureCreateInfoNV* createInfo);
-    void record(VulkanDevice& device, VkAccelerationStructureInstanceNV* instances, VkAccelerationStructureCreateInfoNV* createInfo);
+    // builds from the instances written through acquireInstances, or from a copy of filtered when it isn't null
+    void record(VulkanDevice& device, VkAccelerationStructureCreateInfoNV* createInfo, ScratchArena& scratch, const VkAccelerationStructureInstanceNV* filtered = nullptr, bool update = false,
+        VkSemaphore waitSemaphore = VK_NULL_HANDLE, uint64_t waitValue = 0);
+    void refit(VkDevice device, VkCommandBuffer cmdBuffer, VkAccelerationStructureCreateInfoNV* createInfo, VkBuffer scratchBuffer, VkDeviceSize scratchOffset, uint64_t frame, bool update = true);
     void destroy(VkDevice device, VmaAllocator allocator);
+    void wait(VkDevice device);
+
+    // one instance buffer per frame in flight, so the next frame's instances can be written while the GPU still reads the previous ones.
+    // Has to be set before the first record, at least two are used
+    void setSlotCount(uint32_t count);
+
+    // mapped instances of the next build with room for at least capacity, which the instance map writes in place.
+    // The first call after a build waits for the slot's last build and the frames that refit from it, then copies over what changed since from the slot built last.
+    // Growing keeps the contents, the returned pointer is valid until the next call
+    VkAccelerationStructureInstanceNV* acquireInstances(VulkanDevice& device, uint32_t capacity);
+
+    // times the builds of record, optional
+    void setProfiler(GpuProfiler* profiler) { this->profiler = profiler; }
+
+    // needed once refit is used, a slot isn't written again before the frames that refit from it have finished.
+    // Without a release callback replaced instance buffers are destroyed right away
+    void setFrameCallbacks(FrameWait wait, BufferRelease release);
+
+    // marks instances that were written for the next build, which flushes them. The other slots copy them over when it's their turn
+    void invalidate(uint32_t begin, uint32_t end);
+    void destroyInstances(VulkanDevice& device);
+
+    VkDeviceSize getScratchSize(VkDevice device);
+    VkDeviceSize getUpdateScratchSize(VkDevice device);
+
+private:
+    uint32_t getWriteSlot() const { return (activeSlot + 1) % static_cast<uint32_t>(slots.size()); }
+    void openWriteSlot(VulkanDevice& device);
+    void growInstances(VulkanDevice& device, InstanceBuffer& instanceBuffer, uint32_t capacity, uint32_t keep);
+    void releaseInstances(VulkanDevice& device, InstanceBuffer& instanceBuffer);
+
+    std::vector<InstanceSlot> slots = std::vector<InstanceSlot>(2);
+    uint32_t activeSlot = 0;
+
+    // whether the write slot was brought up to date since the last build
+    bool writeSlotOpen = false;
+    GpuProfiler* profiler = nullptr;
+
+    FrameWait frameWait;
+    BufferRelease bufferRelease;
 };
 
 
@@ -6,6 +6,7 @@
 #include "ShaderManager.h"
 #include "AccelStructure.h"
 #include "RenderSequence.h"
+#include "GpuProfiler.h"
 
 namespace scatter {
 
@@ -36,6 +37,8 @@ private:
     VulkanBuffer indexBuffer;
     BottomLevelAS bottomLevelAS;
     TopLevelAS topLevelAS;
+    ScratchArena scratchArena;
+    GpuProfiler gpuProfiler;
 
     std::vector<VkSemaphore> imageAvailableSemaphore;
     std::vector<VkSemaphore> renderFinishedSemaphore;
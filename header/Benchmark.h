@@ -0,0 +1,58 @@
+#pragma once
+
+#include "Device.h"
+#include "Object.h"
+#include "Scatter.h"
+
+namespace scatter {
+
+// Measures Scatter through its public API without a window, run the sample with --benchmark.
+// Every configuration gets a Scatter of its own, so the timings of one don't end up in the history of the next.
+// The depth texture is imported into a device of its own and cleared, the way a host application would render into it
+class Benchmark {
+public:
+    void init(uint32_t width, uint32_t height);
+    void run();
+    void destroy();
+
+private:
+    // CPU time of submit when the recorded trace is submitted as is, and when it's recorded anew every frame
+    void measureSubmit();
+
+    // wall time of adding the same meshes with one addMesh call each and with a single addMeshes call
+    void compareMeshRegistration();
+
+    // shadow trace time of a shuffled scene of 100k instances, with and without sorting the instances before the build
+    void compareInstanceSorting();
+
+    // build time, trace time and memory of bottom level structures built with every build preference
+    void compareBuildPreferences();
+
+    // instance count, top level build time and trace time of many small static instances, before and after baking them
+    void compareStaticBatching();
+
+    void initScatter(Scatter& scatter);
+    void clearDepth(Scatter& scatter, float depth);
+
+    uint64_t addSphere(Scatter& scatter);
+
+    // a cube of spheres in front of the cleared depth, in the direction of the light, cycling through the meshes.
+    // Shuffling leaves the instances without any spatial order. Returns the instance handles
+    std::vector<uint64_t> addSphereGrid(Scatter& scatter, const std::vector<uint64_t>& meshes, uint32_t count, bool shuffle);
+
+    // submits count frames and returns the average CPU time of submit in microseconds. The GPU is waited for before every
+    // submit, so submit never blocks on a frame slot and only its own work is timed. Re-recording cycles through more heights
+    // than there are frames in flight, so every frame slot finds its recording out of date
+    double traceFrames(Scatter& scatter, uint32_t count, bool rerecord);
+
+    static constexpr uint32_t framesInFlight = 2;
+    static constexpr uint32_t frameCount = 300;
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    VulkanDevice device;
+    Object sphere;
+};
+
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// CPU zones are compiled in unless SCATTER_TRACE is defined as 0, writeTrace still writes an empty trace then
+#ifndef SCATTER_TRACE
+#define SCATTER_TRACE 1
+#endif
+
+namespace scatter {
+
+// nanoseconds on the steady clock, which is QueryPerformanceCounter on Windows, so zones line up with other traces of the process
+inline uint64_t traceNow() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Times the scope it lives in. The zone is written to a ring buffer of the calling thread when it ends, which keeps
+// the last zones of every thread around for writeTrace. The name isn't copied, so it has to be a string literal
+class TraceZone {
+public:
+    explicit TraceZone(const char* name) : name(name), begin(traceNow()) {}
+    ~TraceZone();
+
+    TraceZone(const TraceZone&) = delete;
+    TraceZone& operator=(const TraceZone&) = delete;
+
+private:
+    const char* name;
+    uint64_t begin;
+};
+
+// Writes the zones of all threads as Chrome trace event JSON, which chrome://tracing and Perfetto open. Throws if the file can't be written
+void writeTrace(const char* path);
+
+}
+
+#if SCATTER_TRACE
+#define SCATTER_ZONE_CONCAT_IMPL(a, b) a##b
+#define SCATTER_ZONE_CONCAT(a, b) SCATTER_ZONE_CONCAT_IMPL(a, b)
+#define SCATTER_ZONE(name) ::scatter::TraceZone SCATTER_ZONE_CONCAT(traceZone, __LINE__)(name)
+#else
+#define SCATTER_ZONE(name) ((void)0)
+#endif
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+
+namespace scatter {
+
+// Defers the destruction of GPU resources until the frame that last used them has retired.
+// Frames are numbered by the caller, entries are released in order once their frame is known to be complete.
+class DeletionQueue {
+public:
+    void push(uint64_t frame, std::function<void()>&& deleter);
+    void collect(uint64_t completedFrame);
+    void flush();
+
+    size_t size() const { return entries.size(); }
+
+    // frame of the newest entry, pushes have to use this frame or a later one
+    uint64_t lastFrame() const { return entries.empty() ? 0 : entries.back().frame; }
+
+private:
+    struct Entry {
+        uint64_t frame;
+        std::function<void()> deleter;
+    };
+
+    std::deque<Entry> entries;
+};
+
+}
@@ -14,6 +14,13 @@ struct QueueFamilyIndices
     bool isComplete();
 };
 
+// the extension acceleration structures are built with, picked once when the device is created
+enum class RayTracingExtension {
+    AUTO, // KHR if the device supports it, NV otherwise
+    NV, // VK_NV_ray_tracing, shadows are traced by a ray tracing pipeline
+    KHR // VK_KHR_acceleration_structure, shadows are traced by a compute shader using ray queries
+};
+
 struct SwapChainSupportDetails
 {
     VkSurfaceCapabilitiesKHR capabilities;
@@ -29,11 +36,17 @@ class VulkanDevice {
     friend class AccelerationStructureBuilder;
     friend struct BottomLevelAS;
     friend struct TopLevelAS;
+    friend class ScratchArena;
+    friend class UploadBuffer;
+    friend class GpuProfiler;
     friend class Scatter;
+    friend class Benchmark;
 public:
-    void init();
+    void init(RayTracingExtension extension = RayTracingExtension::NV);
     void destroy();
 
+    RayTracingExtension getRayTracingExtension() const { return rayTracingExtension; }
+
     VkCommandBuffer beginSingleTimeCommands();
     void endSingleTimeCommands(VkCommandBuffer buffer);
 
@@ -45,16 +58,18 @@ private:
     VkDebugUtilsMessengerEXT debugMessenger;
 
     VkQueue graphicsQueue;
+    VkQueue asyncQueue;
 
     VkCommandPool commandPool;
     std::vector<VkCommandBuffer> commandBuffers;
 
     VkDescriptorPool descriptorPool;
 
+    RayTracingExtension rayTracingExtension = RayTracingExtension::NV;
+
     const std::vector<const char*> validationLayers = { "VK_LAYER_KHRONOS_validation" };
     std::vector<const char*> deviceExtensions = { 
         VK_KHR_SWAPCHAIN_EXTENSION_NAME, 
-        VK_NV_RAY_TRACING_EXTENSION_NAME, 
         VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME,
         VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME,
         VK_KHR_EXTERNAL_SEMAPHORE_EXTENSION_NAME,
@@ -62,6 +77,16 @@ private:
         VK_KHR_EXTERNAL_SEMAPHORE_WIN32_EXTENSION_NAME
     };
 
+    // enabled on top of deviceExtensions, depending on the ray tracing extension
+    const std::vector<const char*> nvRayTracingExtensions = { 
+        VK_NV_RAY_TRACING_EXTENSION_NAME 
+    };
+    const std::vector<const char*> khrRayTracingExtensions = { 
+        VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME,
+        VK_KHR_RAY_QUERY_EXTENSION_NAME,
+        VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME
+    };
+
     VkCommandBuffer createCommandBuffer();
     void createCommandPool();
     void createCommandBuffers();
@@ -74,7 +99,9 @@ private:
     std::vector<const char*> getRequiredExtensions();
     void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo);
     QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);
-    bool checkDeviceExtensionSupport(VkPhysicalDevice device);
+    bool checkDeviceExtensionSupport(VkPhysicalDevice device, const std::vector<const char*>& extensions);
+    bool checkRayQuerySupport(VkPhysicalDevice device);
+    std::optional<RayTracingExtension> findRayTracingExtension(VkPhysicalDevice device, RayTracingExtension requested);
     void createDescriptorPool();
 
 };
@@ -19,8 +19,43 @@ public:
     inline static PFN_vkBindAccelerationStructureMemoryNV vkBindAccelerationStructureMemoryNV;
     inline static PFN_vkGetRayTracingShaderGroupHandlesNV vkGetRayTracingShaderGroupHandlesNV;
     inline static PFN_vkGetAccelerationStructureMemoryRequirementsNV vkGetAccelerationStructureMemoryRequirementsNV;
+    inline static PFN_vkCmdCopyAccelerationStructureNV vkCmdCopyAccelerationStructureNV;
+    inline static PFN_vkCmdWriteAccelerationStructuresPropertiesNV vkCmdWriteAccelerationStructuresPropertiesNV;
 
     static void init(VkDevice device);
 };
 
+class vk_khr_acceleration_structure {
+public:
+    // set by init, acceleration structures are created through this extension instead of VK_NV_ray_tracing
+    inline static bool enabled = false;
+
+    inline static PFN_vkCreateAccelerationStructureKHR vkCreateAccelerationStructureKHR;
+    inline static PFN_vkDestroyAccelerationStructureKHR vkDestroyAccelerationStructureKHR;
+    inline static PFN_vkCmdBuildAccelerationStructuresKHR vkCmdBuildAccelerationStructuresKHR;
+    inline static PFN_vkGetAccelerationStructureBuildSizesKHR vkGetAccelerationStructureBuildSizesKHR;
+    inline static PFN_vkGetAccelerationStructureDeviceAddressKHR vkGetAccelerationStructureDeviceAddressKHR;
+    inline static PFN_vkCmdCopyAccelerationStructureKHR vkCmdCopyAccelerationStructureKHR;
+    inline static PFN_vkCmdCopyAccelerationStructureToMemoryKHR vkCmdCopyAccelerationStructureToMemoryKHR;
+    inline static PFN_vkCmdCopyMemoryToAccelerationStructureKHR vkCmdCopyMemoryToAccelerationStructureKHR;
+    inline static PFN_vkCmdWriteAccelerationStructuresPropertiesKHR vkCmdWriteAccelerationStructuresPropertiesKHR;
+    inline static PFN_vkGetDeviceAccelerationStructureCompatibilityKHR vkGetDeviceAccelerationStructureCompatibilityKHR;
+
+    static void init(VkDevice device);
+};
+
+// buffer usage of geometry and instances read by acceleration structure builds
+inline static VkBufferUsageFlags GetBuildInputUsage() {
+    return vk_khr_acceleration_structure::enabled 
+        ? VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT 
+        : VK_BUFFER_USAGE_RAY_TRACING_BIT_NV;
+}
+
+// buffer usage of acceleration structure build scratch memory
+inline static VkBufferUsageFlags GetScratchUsage() {
+    return vk_khr_acceleration_structure::enabled 
+        ? VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT 
+        : VK_BUFFER_USAGE_RAY_TRACING_BIT_NV;
+}
+
 }
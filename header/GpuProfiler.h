@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Device.h"
+#include "Scatter.h"
+
+namespace scatter {
+
+// the GPU work that is timed, RASTER is only used by the sample application
+enum class GpuPass : uint32_t {
+    SHADOW_TRACE,
+    BLAS_BUILD,
+    TLAS_BUILD,
+    RASTER,
+    COUNT
+};
+
+// Timestamp queries around GPU passes, with a query pool per frame in flight.
+// A frame's timestamps are read back when the frame comes around again, the GPU is done with them by then,
+// so reading never stalls. Every pass keeps its last historySize runs for the statistics.
+class GpuProfiler {
+public:
+    static constexpr uint32_t maxScopes = 64;
+    static constexpr uint32_t historySize = 256;
+    static constexpr uint32_t noScope = UINT32_MAX;
+
+    void init(VulkanDevice& device, uint32_t frameCount);
+    void destroy(VkDevice device);
+
+    // reads back what the frame timed the last time it was used and resets its queries on the host.
+    // Work timed after this is written to this frame, until the next call
+    void beginFrame(VkDevice device, uint32_t frame);
+
+    // timestamps around work for the active frame, end takes what begin returned. Returns noScope if the frame ran out of queries
+    uint32_t begin(VkCommandBuffer cmdBuffer, GpuPass pass);
+    void end(VkCommandBuffer cmdBuffer, uint32_t scope);
+
+    // timestamps for command buffers that are recorded once and submitted with the same frame every time,
+    // each pass has a pair of queries set aside per frame for them
+    void beginRecorded(VkCommandBuffer cmdBuffer, uint32_t frame, GpuPass pass);
+    void endRecorded(VkCommandBuffer cmdBuffer, uint32_t frame, GpuPass pass);
+
+    PassTiming getTiming(GpuPass pass) const;
+
+private:
+    struct Frame {
+        VkQueryPool pool = VK_NULL_HANDLE;
+        // pass of every scope handed out since the last reset, their queries follow the recorded pairs
+        std::vector<GpuPass> scopes;
+    };
+
+    struct History {
+        std::array<float, historySize> samples;
+        uint32_t count = 0;
+        uint32_t next = 0;
+    };
+
+    void addSample(GpuPass pass, uint64_t begin, uint64_t end);
+
+    static constexpr uint32_t recordedQueries = 2 * static_cast<uint32_t>(GpuPass::COUNT);
+    static constexpr uint32_t queryCount = recordedQueries + 2 * maxScopes;
+
+    std::vector<Frame> frames;
+    uint32_t activeFrame = 0;
+    std::array<History, static_cast<size_t>(GpuPass::COUNT)> histories;
+
+    // zero if the graphics queue has no timestamps, everything is a no-op then
+    uint64_t timestampMask = 0;
+    float timestampPeriod = 1.0f;
+};
+
+// minimum, average and nearest rank 99th percentile of the samples, sorts them
+PassTiming summarizeSamples(float* samples, size_t count);
+
+}
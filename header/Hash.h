@@ -0,0 +1,9 @@
+#pragma once
+
+namespace scatter {
+
+// 64 bit xxHash (XXH64). Four independent accumulators process 32 bytes per step,
+// which keeps the multiply pipelines busy and runs at memory speed for large buffers.
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0);
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+namespace scatter {
+
+// Dense slot map of top level instances.
+// Instances are stored contiguously in storage the owner hands out, the mapped instance buffer of the next build,
+// so they're written where the build reads them. Handles stay valid when other instances are removed.
+// Every modification is tracked as a range of dense indices, so the other instance buffers only have to copy what changed.
+class InstanceMap {
+public:
+    // returns storage for at least capacity instances that holds the current ones, called before every modification
+    using Storage = std::function<VkAccelerationStructureInstanceNV*(uint32_t capacity)>;
+
+    void setStorage(Storage storage) { this->storage = std::move(storage); }
+
+    uint64_t add(const VkAccelerationStructureInstanceNV& instance);
+
+    // adds count uninitialized instances at the end and returns them for the caller to fill in, handles receives one per instance
+    VkAccelerationStructureInstanceNV* append(size_t count, uint64_t* handles);
+
+    bool remove(uint64_t handle);
+    bool setTransform(uint64_t handle, const float* transform);
+    void clear();
+
+    // null for stale handles, valid until the next modification
+    const VkAccelerationStructureInstanceNV* find(uint64_t handle);
+
+    // reorders the instances by ascending key, one key per dense index. Handles stay valid
+    void sort(const std::vector<uint64_t>& keys);
+
+    const VkAccelerationStructureInstanceNV* data() const { return instances; }
+    uint32_t size() const { return instanceCount; }
+
+    // changes since the last call to resetChanges
+    bool hasChanges() const { return dirtyBegin < dirtyEnd || topologyDirty; }
+    bool isTopologyDirty() const { return topologyDirty; }
+    uint32_t getDirtyBegin() const { return dirtyBegin; }
+    uint32_t getDirtyEnd() const { return std::min(dirtyEnd, size()); }
+    void resetChanges();
+
+private:
+    struct Slot {
+        uint32_t index = 0;
+        uint32_t generation = 1;
+    };
+
+    Slot* getSlot(uint64_t handle);
+    void markDirty(uint32_t index);
+    void reserve(uint32_t capacity);
+
+    Storage storage;
+    VkAccelerationStructureInstanceNV* instances = nullptr;
+    uint32_t instanceCount = 0;
+    std::vector<uint32_t> slotIndices;
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeSlots;
+
+    uint32_t dirtyBegin = UINT32_MAX;
+    uint32_t dirtyEnd = 0;
+    bool topologyDirty = false;
+};
+
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "Scatter.h"
+
+namespace scatter {
+
+// Writes the upper 3x4 of count 4x4 matrices into the row major transforms of instances, transposing column major input.
+// Each matrix is 16 tightly packed floats, the instances are only written to in their transform, so they can be mapped instance buffer memory.
+void packTransforms(const float* matrices, size_t count, MatrixLayout layout, VkAccelerationStructureInstanceNV* instances);
+
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+namespace scatter {
+
+// On-disk cache of serialized bottom level acceleration structures, keyed by the hash of their geometry.
+// A cache written by another device or driver is discarded as a whole, the driver still has the final say about every blob.
+class MeshCache {
+public:
+    // bump whenever the file layout or the hashed geometry key changes
+    static constexpr uint32_t version = 3;
+
+    void open(const std::filesystem::path& path, const uint8_t* deviceUUID, const uint8_t* driverUUID);
+    void save();
+    void close();
+
+    bool isOpen() const { return !path.empty(); }
+
+    const std::vector<uint8_t>* find(uint64_t hash) const;
+    void store(uint64_t hash, std::vector<uint8_t>&& blob);
+    void erase(uint64_t hash);
+
+    size_t size() const { return entries.size(); }
+
+private:
+    std::filesystem::path path;
+    std::array<uint8_t, VK_UUID_SIZE> deviceUUID;
+    std::array<uint8_t, VK_UUID_SIZE> driverUUID;
+    std::unordered_map<uint64_t, std::vector<uint8_t>> entries;
+    bool dirty = false;
+};
+
+}
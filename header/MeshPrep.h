@@ -0,0 +1,29 @@
+#pragma once
+
+#include "Scatter.h"
+
+namespace scatter {
+
+// Copies the positions out of interleaved vertices into a tight xyz float stream, missing components are zero.
+// Dispatches to a copy specialized for the format, which moves every position with a single SSE load and store.
+void extractPositions(VertexFormat format, const void* vertices, size_t stride, size_t count, float* positions);
+
+// Writes the positions referenced by indices to welded, merging equal ones. They keep the order of their first use.
+// Indices are rewritten in place to point into welded and have to be smaller than vertexCount.
+void weldPositions(const float* positions, size_t vertexCount, std::vector<uint32_t>& indices, std::vector<float>& welded);
+
+// Drops triangles that repeat a vertex or have no area, the kept indices are moved to the front.
+// Returns the number of indices kept.
+size_t removeDegenerateTriangles(const std::vector<float>& positions, uint32_t* indices, size_t indexCount);
+
+// Per axis scale and bias that turn encoded positions in [-1, 1] back into the positions they were made from.
+struct PositionDecode {
+    float scale[3] = { 1.0f, 1.0f, 1.0f };
+    float bias[3] = { 0.0f, 0.0f, 0.0f };
+};
+
+// Encodes tight xyz positions as four 16 bit components per vertex, normalized to [-1, 1] over their bounds. The fourth component is zero.
+// Writes SNORM16 values or, if halfFloat is set, half floats. Returns the decode that has to be applied to the encoded positions.
+PositionDecode encodePositions(const float* positions, size_t count, bool halfFloat, uint16_t* encoded);
+
+}
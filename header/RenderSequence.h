@@ -56,41 +56,57 @@ private:
 
 class RayTracedShadowsSequence {
 public:
-    struct {
+    // copied to the uniform buffer slot of a frame by updateUniforms, so recorded command buffers don't have to change
+    struct Uniforms {
         glm::vec4 lightDirection = { 0, -1, 0, 1.0 };
         glm::mat4 inverseViewProjection = glm::mat4(1.0f);
-    } pushData;
+    } uniforms;
 
     HANDLE getMemoryHandle(VkDevice device, VkDeviceMemory memory);
 
     HANDLE getDepthTextureMemoryHandle(VkDevice device);
     HANDLE getShadowTextureMemoryHandle(VkDevice device);
 
-    void init(VkDevice device, VmaAllocator allocator, VkPhysicalDevice pdevice, VulkanShaderManager& shaderManager);
+    // rayQuery traces from a compute shader with ray queries instead of a ray tracing pipeline, needs VK_KHR_ray_query.
+    // Every frame in flight gets its own slot in the uniform buffer
+    void init(VkDevice device, VmaAllocator allocator, VkPhysicalDevice pdevice, VulkanShaderManager& shaderManager, bool rayQuery = false, uint32_t frameCount = 1);
     void destroy(VkDevice device, VmaAllocator allocator, VkDescriptorPool descriptorPool);
 
     void createImages(VkDevice device, VkExtent2D extent, VkPhysicalDeviceMemoryProperties* memProperties);
-    void updateImages(VkDevice device);
     void destroyImages(VkDevice device);
 
-    void updateTLAS(VkDevice device, VkAccelerationStructureNV tlas);
+    // write the descriptor set of frame, which must not be in use by the GPU
+    void updateImages(VkDevice device, uint32_t frame = 0);
+    void updateTLAS(VkDevice device, VkAccelerationStructureNV tlas, uint32_t frame = 0);
+    void updateTLAS(VkDevice device, VkAccelerationStructureKHR tlas, uint32_t frame = 0);
 
+    // a descriptor set per frame in flight, so a frame's bindings can change while the others are pending
     void createDescriptorSets(VkDevice device, VkDescriptorPool descriptorPool);
     void createPipeline(VkDevice device, VulkanShaderManager& shaderManager);
+    void createComputePipeline(VkDevice device, VulkanShaderManager& shaderManager);
     void createSbtTable(VkDevice device, VmaAllocator allocator, const VkPhysicalDeviceRayTracingPropertiesNV& rtProps);
+    void createUniformBuffer(VmaAllocator allocator, VkPhysicalDevice pdevice);
+
+    // writes uniforms to the slot of frame, which must not be in use by the GPU
+    void updateUniforms(VmaAllocator allocator, uint32_t frame);
 
-    void execute(VkDevice device, VkCommandBuffer cmdBuffer, uint32_t width, uint32_t height, const VkPhysicalDeviceRayTracingPropertiesNV& rtProps);
+    // reads the uniforms from the slot of frame and binds its descriptor set
+    void execute(VkDevice device, VkCommandBuffer cmdBuffer, uint32_t width, uint32_t height, const VkPhysicalDeviceRayTracingPropertiesNV& rtProps, uint32_t frame = 0);
 
     // textures
     TextureEXT depthTexture;
     TextureEXT shadowsTexture;
 private:
+    void createLayouts(VkDevice device, VkShaderStageFlags stages, VkDescriptorType accelerationStructureType, uint32_t pushConstantSize);
+
+    bool rayQuery = false;
+
     // pipeline stuff
     VkPipeline pipeline;
     VkPipelineLayout pipelineLayout;
 
     // descriptor set stuff
-    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSet> descriptorSets;
     VkDescriptorSetLayout descriptorSetLayout;
     VkWriteDescriptorSet writeDescriptorSet;
     VkDescriptorBufferInfo descriptorBufferInfo;
@@ -99,6 +115,13 @@ private:
     VkBuffer sbtBuffer;
     VmaAllocation sbtAlloc;
     std::vector<VkRayTracingShaderGroupCreateInfoNV> groups;
+
+    // one slot of uniforms per frame in flight, selected with a dynamic offset
+    VkBuffer uniformBuffer;
+    VmaAllocation uniformBufferAlloc;
+    VmaAllocationInfo uniformBufferAllocInfo;
+    VkDeviceSize uniformStride = 0;
+    uint32_t frameCount = 1;
 };
 
 }
\ No newline at end of file
@@ -29,6 +29,14 @@ enum class SCATTER_API IndexFormat : unsigned int {
     UINT32 = 1 /**< 32 bit unsigned integer */
 };
 
+/**
+ * Describes how the elements of a 4x4 transformation matrix are ordered in memory, see Scatter::addInstances.
+ */
+enum class SCATTER_API MatrixLayout : unsigned int {
+    ROW_MAJOR = 0, /**< rows are contiguous, the translation is in the last element of the first three rows */
+    COLUMN_MAJOR = 1 /**< columns are contiguous, the translation is in elements 12 to 14, as in glm::mat4 */
+};
+
 /** @struct
  * Struct that describes the input layout. 
  */
@@ -43,6 +51,141 @@ struct SCATTER_API BufferDescription {
     IndexFormat indexFormat = IndexFormat::UINT32;
 };
 
+/**
+ * Describes the Vulkan extension used to build acceleration structures and trace shadows, see Scatter::init.
+ * Both backends trace the same rays and write the same shadow texture format.
+ */
+enum class SCATTER_API RayTracingBackend : unsigned int {
+    AUTO = 0, /**< KHR_RAY_QUERY if the device supports it, NV_RAY_TRACING otherwise */
+    NV_RAY_TRACING = 1, /**< VK_NV_ray_tracing, shadows are traced by a ray tracing pipeline */
+    KHR_RAY_QUERY = 2 /**< VK_KHR_acceleration_structure and VK_KHR_ray_query, shadows are traced by a compute shader */
+};
+
+/**
+ * Describes the trade-offs the driver makes when building a bottom level acceleration structure. Values can be combined.
+ */
+enum class SCATTER_API BuildPreference : unsigned int {
+    NONE = 0, /**< let the driver decide */
+    ALLOW_COMPACTION = 2, /**< allow compacting the structure after building it, see Scatter::setMeshCompaction */
+    PREFER_FAST_TRACE = 4, /**< take longer to build for faster tracing, for static geometry */
+    PREFER_FAST_BUILD = 8, /**< build faster at the cost of tracing speed, for geometry that is rebuilt often */
+    LOW_MEMORY = 16, /**< trade speed for a smaller structure */
+    SCENE_DEFAULT = 0x80000000 /**< use the preference set by Scatter::setBuildPreference */
+};
+
+inline BuildPreference operator|(BuildPreference a, BuildPreference b) {
+    return static_cast<BuildPreference>(static_cast<unsigned int>(a) | static_cast<unsigned int>(b));
+}
+
+/** @struct
+ * Struct that describes a range of a mesh that is built as a separate geometry, see Scatter::addMesh.
+ */
+struct SCATTER_API SubmeshDescription {
+    /** vertexOffset describes the first vertex of the submesh, indices are relative to it. */
+    unsigned int vertexOffset = 0;
+    /** indexOffset describes the first index of the submesh. */
+    unsigned int indexOffset = 0;
+    /** indexCount describes the number of indices of the submesh. */
+    unsigned int indexCount = 0;
+    /** opaque describes whether the submesh always blocks light. Defaults to true. */
+    bool opaque = true;
+};
+
+/** @struct
+ * Struct that describes a single mesh for batched registration, see Scatter::addMeshes.
+ * Vertex and index data are interpreted using the internal BufferDescription.
+ */
+struct SCATTER_API MeshDescription {
+    /** vertices points to vertexCount vertices. */
+    void* vertices = nullptr;
+    /** indices points to indexCount indices. */
+    void* indices = nullptr;
+    /** vertexCount describes the number of vertices. */
+    unsigned int vertexCount = 0;
+    /** indexCount describes the number of indices. */
+    unsigned int indexCount = 0;
+    /** submeshes points to submeshCount submesh ranges. If null, the whole mesh is a single geometry. */
+    const SubmeshDescription* submeshes = nullptr;
+    /** submeshCount describes the number of submeshes. */
+    unsigned int submeshCount = 0;
+    /** buildPreference describes how the bottom level acceleration structure is built. Defaults to the scene default. */
+    BuildPreference buildPreference = BuildPreference::SCENE_DEFAULT;
+    /** batchable keeps the geometry on the GPU after the build, so static instances of the mesh can be merged by Scatter::bakeStatic. */
+    bool batchable = false;
+    /** shadowProxyRatio, if below one, builds the structure from a simplified proxy with about this fraction of the triangles. */
+    float shadowProxyRatio = 1.0f;
+    /** shadowProxyError, if above zero, stops simplifying before the proxy moves further than this distance from the mesh surface. */
+    float shadowProxyError = 0.0f;
+};
+
+/** @struct
+ * Struct that reports the state of the acceleration structure build scratch memory, see Scatter::getScratchStats.
+ */
+struct SCATTER_API ScratchStats {
+    /** capacity describes the currently allocated scratch memory in bytes. */
+    size_t capacity = 0;
+    /** highWaterMark describes the largest single build scratch requirement seen so far in bytes. */
+    size_t highWaterMark = 0;
+    /** allocationCount describes the number of scratch ranges handed out to builds. */
+    uint64_t allocationCount = 0;
+    /** growCount describes how many times the scratch memory had to be re-allocated. */
+    uint64_t growCount = 0;
+};
+
+/** @struct
+ * Struct that reports the memory used by a single mesh, see Scatter::getMeshMemoryStats.
+ */
+struct SCATTER_API MeshMemoryStats {
+    /** buildSize describes the bytes allocated for the bottom level acceleration structure before compaction. */
+    size_t buildSize = 0;
+    /** size describes the bytes currently allocated for the bottom level acceleration structure. */
+    size_t size = 0;
+    /** sourceTriangleCount describes the number of triangles the mesh was added with. */
+    uint32_t sourceTriangleCount = 0;
+    /** triangleCount describes the number of triangles in the bottom level acceleration structure, fewer than the source for shadow proxies. */
+    uint32_t triangleCount = 0;
+};
+
+/** @struct
+ * Struct that reports the result of merging static instances, see Scatter::bakeStatic.
+ */
+struct SCATTER_API StaticBatchStats {
+    /** instanceCountBefore describes the number of top level instances before baking. */
+    uint32_t instanceCountBefore = 0;
+    /** instanceCountAfter describes the number of top level instances after baking. */
+    uint32_t instanceCountAfter = 0;
+    /** bakedInstanceCount describes the number of static instances that were merged. */
+    uint32_t bakedInstanceCount = 0;
+    /** batchCount describes the number of merged bottom level acceleration structures that were built. */
+    uint32_t batchCount = 0;
+};
+
+/** @struct
+ * Struct that reports the GPU time of a pass over its last timed runs in milliseconds, see Scatter::getGpuTimings.
+ */
+struct SCATTER_API PassTiming {
+    /** sampleCount describes the number of timed runs the statistics are made from, zero if the pass didn't run. */
+    uint32_t sampleCount = 0;
+    /** min describes the shortest run. */
+    float min = 0.0f;
+    /** avg describes the average run. */
+    float avg = 0.0f;
+    /** p99 describes the run 99 percent of the runs were at least as fast as. */
+    float p99 = 0.0f;
+};
+
+/** @struct
+ * Struct that reports the GPU time of the work Scatter submits, see Scatter::getGpuTimings.
+ */
+struct SCATTER_API GpuTimings {
+    /** shadowTrace describes the shadow trace of submit. */
+    PassTiming shadowTrace;
+    /** blasBuild describes the bottom level builds of a call, and the refits of deformable meshes in submit. */
+    PassTiming blasBuild;
+    /** tlasBuild describes the top level builds of build, and the refits in submit. */
+    PassTiming tlasBuild;
+};
+
 /** @class
  * Object that contains the entire Scatter API. This object should only ever be constructed once in a host application.
  * It is implemented using the PIMPL idiom, hiding internal data from the resulting binary.
@@ -70,10 +213,37 @@ public:
     Scatter& operator=(Scatter&&) noexcept = default;
 
     /**
-     * Init function that sets up the vulkan device and resources, takes no arguments.
+     * Sets how many frames the CPU may submit before waiting on the GPU. Defaults to 2. Has to be called before init.
+     * Every frame in flight has its own command buffers, fence, uniforms and instance buffer, so more frames cost a bit of memory
+     * and add latency to the shadows, but keep submit from blocking when the GPU falls behind for a frame.
+     * @param count the number of frames in flight, at least 1.
+     * @return void
+     */
+    void setFramesInFlight(uint32_t count);
+
+    /**
+     * Exports timeline semaphores instead of the binary ready and done pair. Disabled by default. Has to be called before init.
+     * In timeline mode submit waits until the ready semaphore reaches the value the host passes and returns the value the done
+     * semaphore is set to, so the host can keep several frames in flight and wait on, or poll, any one of them.
+     * Throws during init if the device can't export timeline semaphores.
+     * @param enabled true to export timeline semaphores.
      * @return void
      */
-    void init();
+    void setTimelineSemaphores(bool enabled);
+
+    /**
+     * Init function that sets up the vulkan device and resources.
+     * Picks the first device that supports the requested backend, throws if there is none.
+     * @param backend describes the Vulkan extension used for ray tracing. Defaults to AUTO.
+     * @return void
+     */
+    void init(RayTracingBackend backend = RayTracingBackend::AUTO);
+
+    /**
+     * Gets the backend picked by init, AUTO is resolved to the backend in use.
+     * @return RayTracingBackend that describes the extension in use.
+     */
+    RayTracingBackend getBackend();
 
     /**
      * Sets the vertex stride of the internal BufferDescription.
@@ -142,13 +312,13 @@ public:
     size_t getDepthTextureMemorySize();
 
     /**
-     * Get the win32 HANDLE to the semaphore thats signaled before submit.
+     * Get the win32 HANDLE to the semaphore thats signaled before submit. A timeline semaphore in timeline mode.
      * @return void* that refers to the exported semaphore. Can be type cast to win32 HANDLE.
      */
     void* getReadySemaphoreHandle();
     
     /**
-     * Get the win32 HANDLE to the semaphore thats signaled when all submitted commands are done executing.
+     * Get the win32 HANDLE to the semaphore thats signaled when all submitted commands are done executing. A timeline semaphore in timeline mode.
      * @return void* that refers to the exported semaphore. Can be type cast to win32 HANDLE.
      */
     void* getDoneSemaphoreHandle();
@@ -156,12 +326,37 @@ public:
     /**
      * Submits the render commands to the graphics queue. 
      * The host application should synchronize around it using the exported semaphores.
+     * The trace is recorded once and submitted again as is, it's only recorded anew when the size, the textures or the top level
+     * acceleration structure change. The light direction and the matrix are read from a uniform buffer written here.
      * @param width the width of shadow and depth texture, basically the renderable screen width.
      * @param height the height of shadow and depth texture, basically the renderable screen height.
      * @return void
      */
     void submit(uint32_t width, uint32_t height);
 
+    /**
+     * Submits the render commands like submit(width, height), in timeline mode. See setTimelineSemaphores.
+     * The submitted work waits until the ready semaphore reaches waitValue, the host signals it with increasing values.
+     * @param width the width of shadow and depth texture, basically the renderable screen width.
+     * @param height the height of shadow and depth texture, basically the renderable screen height.
+     * @param waitValue the ready semaphore value to wait for.
+     * @return uint64_t value the done semaphore is set to once this frame is done executing. Increases by one every submit.
+     */
+    uint64_t submit(uint32_t width, uint32_t height, uint64_t waitValue);
+
+    /**
+     * Get the number of the newest submitted frame the GPU has finished, without blocking. Frames are numbered from 1, 
+     * in timeline mode these are the values submit returns and this is the value of the done semaphore.
+     * @return uint64_t number of the last finished frame, 0 if none has finished yet.
+     */
+    uint64_t getCompletedFrame();
+
+    /**
+     * Get the number of submitted frames the GPU hasn't finished yet, at most the frames in flight, see setFramesInFlight.
+     * @return uint32_t that describes how many frames the CPU runs ahead of the GPU.
+     */
+    uint32_t getFrameLatency();
+
     /**
      * @param width width of the texture. Probably the screen region width you want to render to.
      * @param height height of the texture. Probably the screen region height you want to render to.
@@ -180,8 +375,131 @@ public:
      */
     [[nodiscard]] uint64_t addMesh(void* vertices, void* indices, unsigned int vertexCount, unsigned int indexCount);
 
+    /**
+     * Add a mesh that consists of multiple submeshes, e.g. one per material. Every submesh becomes a geometry of a single
+     * bottom level acceleration structure, which traces faster and uses less memory than a mesh per submesh.
+     * @param vertices pointer to the vertex data of all submeshes.
+     * @param indices pointer to the index data of all submeshes.
+     * @param vertexCount total number of vertices.
+     * @param indexCount total number of indices.
+     * @param submeshes array of submeshCount submesh ranges.
+     * @param submeshCount number of submeshes.
+     * @return uint64_t handle to the created bottom level acceleration structure. Keep it around for deletion or instancing.
+     */
+    [[nodiscard]] uint64_t addMesh(void* vertices, void* indices, unsigned int vertexCount, unsigned int indexCount, const SubmeshDescription* submeshes, unsigned int submeshCount);
+
+    /**
+     * Add multiple meshes at once. All geometry is uploaded in a single transfer and every bottom level acceleration structure
+     * is built from a single command buffer, so this is a lot faster than calling addMesh in a loop.
+     * @param meshes array of count mesh descriptions.
+     * @param count number of meshes to add.
+     * @param handles array of count handles that receives the created bottom level acceleration structures, in input order.
+     * @return void
+     */
+    void addMeshes(const MeshDescription* meshes, size_t count, uint64_t* handles);
+
+    /**
+     * Add a single mesh without blocking. The geometry is copied and the bottom level acceleration structure is built on a background queue,
+     * the handle can be instanced right away. Asynchronously added meshes are never compacted.
+     * @param vertices pointer to the vertex data. Only read during this call.
+     * @param indices pointer to the index data. Only read during this call.
+     * @param vertexCount number of vertices.
+     * @param indexCount number of indices.
+     * @return uint64_t handle to the bottom level acceleration structure, see isMeshReady.
+     */
+    [[nodiscard]] uint64_t addMeshAsync(void* vertices, void* indices, unsigned int vertexCount, unsigned int indexCount);
+
+    /**
+     * Add a single mesh whose vertices change over time, e.g. cloth or vegetation. The geometry stays resident on the GPU
+     * and the bottom level acceleration structure is built to be refitted, see updateMeshVertices.
+     * @param vertices pointer to the vertex data. Only read during this call.
+     * @param indices pointer to the index data. Only read during this call.
+     * @param vertexCount number of vertices.
+     * @param indexCount number of indices.
+     * @return uint64_t handle to the created bottom level acceleration structure.
+     */
+    [[nodiscard]] uint64_t addDeformableMesh(void* vertices, void* indices, unsigned int vertexCount, unsigned int indexCount);
+
+    /**
+     * Replace the vertices of a deformable mesh. The vertices are copied right away, the structure and the top level acceleration
+     * structure are refitted at the start of the next submit without waiting on the GPU. Only the last update before a submit is used.
+     * @param handle to a mesh created with addDeformableMesh.
+     * @param vertices pointer to vertexCount vertices in the same layout as the initial vertices.
+     * @return void
+     */
+    void updateMeshVertices(uint64_t handle, void* vertices);
+
+    /**
+     * Check whether the build of a mesh has finished on the GPU. Meshes added through addMesh are always ready.
+     * @param handle to the bottom level acceleration structure.
+     * @return bool true if the mesh can be traced against.
+     */
+    bool isMeshReady(uint64_t handle);
+
+    /**
+     * Block until every mesh added through addMeshAsync has finished building.
+     * @return void
+     */
+    void waitMeshes();
+
+    /**
+     * Enables or disables compaction of meshes added after this call. Disabled by default.
+     * Compaction copies every bottom level acceleration structure into a tightly sized allocation after building it,
+     * which usually saves a lot of memory at the cost of slower mesh registration. Handles are not affected.
+     * @param enabled whether to compact newly added meshes.
+     * @return void
+     */
+    void setMeshCompaction(bool enabled);
+
+    /**
+     * Sets the build preference of meshes added after this call that don't specify their own, see MeshDescription. Defaults to NONE.
+     * Static scenery usually wants PREFER_FAST_TRACE, geometry that is replaced often PREFER_FAST_BUILD.
+     * @param preference the scene wide build preference, can't include SCENE_DEFAULT.
+     * @return void
+     */
+    void setBuildPreference(BuildPreference preference);
+
+    /**
+     * Sets the file used to cache built bottom level acceleration structures between runs. Disabled by default.
+     * The cache is keyed by the geometry and the device and driver that wrote it, anything else is discarded and rebuilt.
+     * It is written when a different file is set, when passing nullptr, and on destroy.
+     * Only backends that can serialize acceleration structures use it, VK_NV_ray_tracing can't and always builds.
+     * @param path to the cache file, nullptr to disable caching.
+     * @return void
+     */
+    void setMeshCache(const char* path);
+
+    /**
+     * Enables or disables deduplication of meshes added after this call. Disabled by default.
+     * The vertex positions and indices of every new mesh are hashed, meshes with byte identical geometry share a single
+     * bottom level acceleration structure. Every mesh still gets its own handle, the structure is freed when the last one is destroyed.
+     * @param enabled whether to deduplicate newly added meshes.
+     * @return void
+     */
+    void setMeshDeduplication(bool enabled);
+
+    /**
+     * Enables or disables compression of the build input of meshes added after this call. Disabled by default.
+     * Positions are uploaded as 16 bit SNORM, or half floats if the device can't build from SNORM, normalized to the bounds of the mesh.
+     * The scale and bias that undo it are folded into the transform of every instance of the mesh. Meshes with at most 65535 vertices
+     * also get 16 bit indices. Halves the upload and the transient geometry memory. SNORM keeps a precision of 1/65534 of the mesh's extent,
+     * half floats have 11 significant bits, so vertices far from the center of the bounds are only precise to about 1/2048 of the extent.
+     * Deformable meshes are never compressed.
+     * @param enabled whether to compress newly added meshes.
+     * @return void
+     */
+    void setInputCompression(bool enabled);
+
+    /**
+     * Get the memory used by a single mesh, before and after compaction.
+     * @param handle to the bottom level acceleration structure.
+     * @return MeshMemoryStats that describes the mesh's memory usage.
+     */
+    MeshMemoryStats getMeshMemoryStats(uint64_t handle);
+
     /**
      * Destroy a single mesh. Changes are visible after rebuilding the top level acceleration structure.
+     * The memory is released once the GPU has finished the frames that may still use it, this call never waits on the GPU.
      * @param handle to the bottom level acceleration structure to delete.
      * @return void
      */
@@ -191,21 +509,124 @@ public:
      * Add a single instance of a mesh.
      * @param handle to the bottom level acceleration structure to add.
      * @param transform world space transformation matrix of the mesh. See 'setInverseViewProjectionMatrix' for safety concerns.
+     * @return uint64_t handle to the instance. Stays valid until the instance is removed or the instances are cleared.
+     */
+    uint64_t addInstance(uint64_t handle, float* transform);
+
+    /**
+     * Add many instances at once. The transforms are packed straight into the mapped instance buffer of the next build, which is a lot faster than
+     * calling addInstance in a loop when pushing tens of thousands of instances per frame.
+     * @param matrices array of count 4x4 world space transformation matrices, 16 floats each, laid out as described by layout.
+     * @param meshes array of count handles to the bottom level acceleration structures to add, invalid ones throw before anything is added.
+     * @param count number of instances to add.
+     * @param layout the element order of the matrices.
+     * @param handles array of count handles that receives the created instances, in input order.
+     * @return void
+     */
+    void addInstances(const float* matrices, const uint64_t* meshes, size_t count, MatrixLayout layout, uint64_t* handles);
+
+    /**
+     * Update the transform of a single instance. Changes are visible after rebuilding the top level acceleration structure.
+     * Only the instances that changed are uploaded, and the structure is refitted if no instances were added or removed.
+     * @param instance handle returned by addInstance.
+     * @param transform world space transformation matrix of the mesh. See 'setInverseViewProjectionMatrix' for safety concerns.
      * @return void
      */
-    void addInstance(uint64_t handle, float* transform);
+    void setInstanceTransform(uint64_t instance, float* transform);
+
+    /**
+     * Remove a single instance. Changes are visible after rebuilding the top level acceleration structure.
+     * @param instance handle returned by addInstance, stale handles throw.
+     * @return void
+     */
+    void removeInstance(uint64_t instance);
+
+    /**
+     * Marks an instance as static, so the next bakeStatic merges it with nearby static instances.
+     * The instance has to reference a mesh added with MeshDescription::batchable.
+     * @param instance handle returned by addInstance.
+     * @return void
+     */
+    void markStatic(uint64_t instance);
+
+    /**
+     * Merges the instances marked static into a few bottom level acceleration structures, one per cell of a uniform grid.
+     * Every merged instance becomes a geometry transformed by its instance transform, and the grid cell becomes a single instance.
+     * Baked instances are removed and their handles become invalid, the merged ones are released by clearInstances or destroy.
+     * Waits for pending asynchronous mesh builds. Changes are visible after rebuilding the top level acceleration structure.
+     * @param cellSize world space size of a grid cell, instances are grouped by their translation.
+     * @return StaticBatchStats that describes the top level instance counts before and after baking.
+     */
+    StaticBatchStats bakeStatic(float cellSize);
 
     /**
      * Clears the top level acceleration structure. Changes are visible after rebuilding the top level acceleration structure.
+     * Invalidates all instance handles.
      * @return void
      */
     void clearInstances();
 
     /**
      * After adding meshes and instances call this to finalize the build of the top level acceleration structure.
+     * If the instances reference the same meshes in the same order as the previous build, the structure is refitted instead of rebuilt.
+     * Does nothing if no instances changed since the previous build. Without any instances the structure is built empty, so nothing casts shadows.
+     * @param waitForMeshes if false, instances of meshes that are not ready yet are left out until a later build.
+     * If true they are included and the GPU waits for their builds to finish, the calling thread never blocks.
+     * @return void
+     */
+    void build(bool waitForMeshes = false);
+
+    /**
+     * Sets how many times build() may refit the top level acceleration structure in place before doing a full rebuild.
+     * Refits are used when only instance transforms changed since the last build, they are much cheaper but degrade trace performance over time.
+     * The refits submit does after updateMeshVertices count as well, once the limit is reached submit rebuilds the structure in place instead.
+     * Defaults to 16, set to zero to always rebuild.
+     * @param limit maximum number of consecutive refits.
+     * @return void
+     */
+    void setTopLevelRefitLimit(uint32_t limit);
+
+    /**
+     * Sorts the instances along a Morton curve through the centers of their world space bounds before every full build
+     * of the top level acceleration structure. Coherent input lets the driver build a tighter tree that traces faster.
+     * Refits keep the previous order. Disabled by default.
+     * @param enabled whether instances are sorted.
+     * @return void
+     */
+    void setInstanceSorting(bool enabled);
+
+    /**
+     * Releases the scratch memory used for building acceleration structures, e.g when you are done loading a level.
+     * It is re-allocated on demand by the next build.
+     * @return void
+     */
+    void trimScratch();
+
+    /**
+     * Get statistics about the scratch memory used for building acceleration structures.
+     * @return ScratchStats that describes the current scratch memory usage.
+     */
+    ScratchStats getScratchStats();
+
+    /**
+     * Get the GPU time of the shadow trace and the acceleration structure builds over roughly the last 256 runs of each.
+     * Timestamps are read back once the frame that wrote them comes around again in the ring of frames in flight, so this never
+     * waits on the GPU, but lags that many frames behind. Builds on the asynchronous queue, see Scatter::addMeshAsync, aren't timed.
+     * All zero if the graphics queue doesn't support timestamps.
+     * @return GpuTimings that describes the minimum, average and 99th percentile time per pass.
+     */
+    GpuTimings getGpuTimings();
+
+    /**
+     * Writes the CPU time spent in Scatter as Chrome trace event JSON, which chrome://tracing and Perfetto open.
+     * Every public function is timed, as well as the queue submits, fence waits and staging copies inside them.
+     * Holds the last 16384 zones of every thread. Zones use the process and thread ids and the QueryPerformanceCounter time base,
+     * so they line up with traces of the host application. Zones are compiled out if Scatter is built with SCATTER_TRACE defined as 0.
+     * Throws if the file can't be written.
+     * @param path the path of the JSON file, overwritten if it exists.
      * @return void
      */
-    void build();
+    void dumpTrace(const char* path);
 
     /**
      * Explicit destroy function. Call this when you want Scatter's lifetime to end.
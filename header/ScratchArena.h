@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Device.h"
+#include "VulkanBuffer.h"
+
+namespace scatter {
+
+struct ScratchAllocation {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+};
+
+// Persistent scratch memory for acceleration structure builds.
+// Grows to the largest build scratch requirement it has seen and hands out aligned sub-ranges,
+// so back to back builds don't need to allocate and free their own scratch buffers.
+class ScratchArena {
+public:
+    // scratch offsets are kept at a conservative alignment that works for every vendor
+    static constexpr VkDeviceSize alignment = 256;
+
+    // the queue the scratch memory is used on, defaults to the graphics queue
+    void setQueue(VkQueue queue) { this->queue = queue; }
+
+    void reserve(VulkanDevice& device, VkDeviceSize size);
+    bool allocate(VkDeviceSize size, ScratchAllocation& allocation);
+    void reset();
+    void trim(VulkanDevice& device);
+
+    VkDeviceSize getCapacity() const { return capacity; }
+    VkDeviceSize getHighWaterMark() const { return highWaterMark; }
+    uint64_t getAllocationCount() const { return allocationCount; }
+    uint64_t getGrowCount() const { return growCount; }
+
+private:
+    void waitIdle(VulkanDevice& device);
+
+    VkQueue queue = VK_NULL_HANDLE;
+    VulkanBuffer buffer;
+    VkDeviceSize capacity = 0;
+    VkDeviceSize head = 0;
+    VkDeviceSize highWaterMark = 0;
+    uint64_t allocationCount = 0;
+    uint64_t growCount = 0;
+};
+
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+namespace scatter {
+
+// Result of simplifyMesh, positions are tightly packed xyz triples referenced by the indices.
+struct SimplifiedMesh {
+    std::vector<float> positions;
+    std::vector<uint32_t> indices;
+};
+
+// Quadric error metric edge collapse (Garland and Heckbert). Equal positions are welded first, so seams in the vertex layout
+// don't block collapses, and open borders are held in place. Collapses the cheapest edge until at most targetIndexCount indices
+// are left, or until the next collapse would move the surface further than maxError from the planes of the triangles it replaces.
+// A maxError of zero means no bound. Only vertices referenced by the result are kept.
+void simplifyMesh(const float* positions, size_t vertexCount, const uint32_t* indices, size_t indexCount, size_t targetIndexCount, float maxError,
+    SimplifiedMesh& result);
+
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "Device.h"
+
+namespace scatter {
+
+// Persistently mapped, host visible buffer that is filled front to back.
+// The owner resets it once the GPU is done with everything that was pushed, it grows when a frame needs more space.
+class UploadBuffer {
+public:
+    VkDeviceSize push(VulkanDevice& device, const void* data, VkDeviceSize size);
+    // overwrites data pushed since the last reset, offset is what push returned for it
+    void write(VkDeviceSize offset, const void* data, VkDeviceSize size);
+    void reset() { head = 0; }
+    void destroy(VulkanDevice& device);
+
+    VkBuffer getBuffer() const { return buffer; }
+
+private:
+    void grow(VulkanDevice& device, VkDeviceSize size);
+
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VmaAllocation alloc = VK_NULL_HANDLE;
+    uint8_t* mapped = nullptr;
+    VkDeviceSize capacity = 0;
+    VkDeviceSize head = 0;
+};
+
+}
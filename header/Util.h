@@ -1,5 +1,7 @@
 #pragma once
 
+#include "Extensions.h"
+
 namespace scatter {
 
 inline static void ImageMemoryBarrier(const VkCommandBuffer commandBuffer, const VkImage image, const VkImageAspectFlags aspectFlags, const VkAccessFlags srcAccessMask, 
@@ -23,4 +25,47 @@ inline static void ImageMemoryBarrier(const VkCommandBuffer commandBuffer, const
 		&barrier);
 }
 
+inline static void GlobalMemoryBarrier(const VkCommandBuffer commandBuffer, const VkAccessFlags srcAccessMask, const VkAccessFlags dstAccessMask, 
+	const VkPipelineStageFlags srcStageMask, const VkPipelineStageFlags dstStageMask) {
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.pNext = nullptr;
+	barrier.srcAccessMask = srcAccessMask;
+	barrier.dstAccessMask = dstAccessMask;
+
+	vkCmdPipelineBarrier(commandBuffer, srcStageMask, dstStageMask, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+// serializes acceleration structure builds that share scratch memory or read each others results
+inline static void AccelerationStructureBarrier(const VkCommandBuffer commandBuffer) {
+	GlobalMemoryBarrier(commandBuffer, 
+		VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_NV | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_NV,
+		VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_NV | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_NV,
+		VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV);
+}
+
+// orders a build that writes a structure after earlier traces that read it, e.g. a top level refit after the previous frame's shadows.
+// Ray queries trace from compute shaders, the NV path from the ray tracing stages
+inline static void TraceToBuildBarrier(const VkCommandBuffer commandBuffer) {
+	const VkPipelineStageFlags traceStage = vk_khr_acceleration_structure::enabled 
+		? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT 
+		: VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV;
+
+	GlobalMemoryBarrier(commandBuffer, 
+		VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_NV,
+		VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_NV | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_NV,
+		traceStage, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV);
+}
+
+// address of the start of buffer, needs a device created with the bufferDeviceAddress feature
+inline static VkDeviceAddress GetBufferAddress(const VkDevice device, const VkBuffer buffer) {
+	if (buffer == VK_NULL_HANDLE) return 0;
+
+	VkBufferDeviceAddressInfo addressInfo = {};
+	addressInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+	addressInfo.buffer = buffer;
+
+	return vkGetBufferDeviceAddress(device, &addressInfo);
+}
+
 } // scatter
\ No newline at end of file
@@ -5,4 +5,7 @@
 %VULKAN_SDK%/Bin32/glslc.exe raytrace.rmiss -o raytrace.rmiss.spv
 %VULKAN_SDK%/Bin32/glslc.exe raytrace.rgen -o raytrace.rgen.spv
 %VULKAN_SDK%/Bin32/glslc.exe raytrace.rchit -o raytrace.rchit.spv
+%VULKAN_SDK%/Bin32/glslc.exe --target-env=vulkan1.2 shadows.comp -o shadows.comp.spv
+%VULKAN_SDK%/Bin32/spirv-val.exe --target-env vulkan1.2 raytrace.rgen.spv
+%VULKAN_SDK%/Bin32/spirv-val.exe --target-env vulkan1.2 shadows.comp.spv
 pause
\ No newline at end of file
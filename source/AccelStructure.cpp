@@ -1,10 +1,150 @@
 #include "pch.h"
 #include "AccelStructure.h"
 #include "VulkanBuffer.h"
+#include "Util.h"
+#include "CpuTrace.h"
 
 namespace scatter {
 
+// KHR build info translated from the NV description, the vectors back the pointers in info
+struct BuildInfoKHR {
+    VkAccelerationStructureBuildGeometryInfoKHR info{};
+    std::vector<VkAccelerationStructureGeometryKHR> geometries;
+    std::vector<VkAccelerationStructureBuildRangeInfoKHR> ranges;
+    std::vector<uint32_t> primitiveCounts;
+};
+
+// type, build flags, geometry flags and formats share their values between the two extensions
+static void translateInfo(VkDevice device, const VkAccelerationStructureInfoNV& infoNV, VkBuffer instanceBuffer, BuildInfoKHR& result) {
+    if (infoNV.type == VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_NV) {
+        VkAccelerationStructureGeometryKHR geometry{};
+        geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+        geometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+        geometry.geometry.instances.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
+        geometry.geometry.instances.arrayOfPointers = VK_FALSE;
+        geometry.geometry.instances.data.deviceAddress = GetBufferAddress(device, instanceBuffer);
+
+        result.geometries.push_back(geometry);
+        result.primitiveCounts.push_back(infoNV.instanceCount);
+    }
+
+    for (uint32_t i = 0; i < infoNV.geometryCount; i++) {
+        const VkGeometryTrianglesNV& trianglesNV = infoNV.pGeometries[i].geometry.triangles;
+
+        VkAccelerationStructureGeometryKHR geometry{};
+        geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+        geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
+        geometry.flags = infoNV.pGeometries[i].flags;
+
+        VkAccelerationStructureGeometryTrianglesDataKHR& triangles = geometry.geometry.triangles;
+        triangles.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
+        triangles.vertexFormat = trianglesNV.vertexFormat;
+        triangles.vertexData.deviceAddress = GetBufferAddress(device, trianglesNV.vertexData) + trianglesNV.vertexOffset;
+        triangles.vertexStride = trianglesNV.vertexStride;
+        triangles.maxVertex = trianglesNV.vertexCount > 0 ? trianglesNV.vertexCount - 1 : 0;
+        triangles.indexType = trianglesNV.indexType;
+        triangles.indexData.deviceAddress = GetBufferAddress(device, trianglesNV.indexData) + trianglesNV.indexOffset;
+
+        if (trianglesNV.transformData != VK_NULL_HANDLE) {
+            triangles.transformData.deviceAddress = GetBufferAddress(device, trianglesNV.transformData) + trianglesNV.transformOffset;
+        }
+
+        result.geometries.push_back(geometry);
+        result.primitiveCounts.push_back(trianglesNV.indexCount / 3);
+    }
+
+    result.ranges.resize(result.primitiveCounts.size());
+
+    for (size_t i = 0; i < result.ranges.size(); i++) {
+        result.ranges[i] = {};
+        result.ranges[i].primitiveCount = result.primitiveCounts[i];
+    }
+
+    result.info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+    result.info.type = static_cast<VkAccelerationStructureTypeKHR>(infoNV.type);
+    result.info.flags = infoNV.flags;
+    result.info.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+    result.info.geometryCount = static_cast<uint32_t>(result.geometries.size());
+    result.info.pGeometries = result.geometries.data();
+}
+
+// creates the structure in a buffer of its own, sized by the build sizes or by the compacted size if there is one
+static void createKHR(VkDevice device, VmaAllocator allocator, VkAccelerationStructureCreateInfoNV* createInfo, VkAccelerationStructureKHR& as, 
+    VkBuffer& buffer, VmaAllocation& alloc, VmaAllocationInfo& allocInfo, VkDeviceSize& scratchSize, VkDeviceSize& updateScratchSize) {
+    VkDeviceSize size = createInfo->compactedSize;
+
+    if (size == 0) {
+        BuildInfoKHR buildInfo;
+        translateInfo(device, createInfo->info, VK_NULL_HANDLE, buildInfo);
+
+        VkAccelerationStructureBuildSizesInfoKHR buildSizes{};
+        buildSizes.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+
+        vk_khr_acceleration_structure::vkGetAccelerationStructureBuildSizesKHR(device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, 
+            &buildInfo.info, buildInfo.primitiveCounts.data(), &buildSizes);
+
+        size = buildSizes.accelerationStructureSize;
+        scratchSize = buildSizes.buildScratchSize;
+        updateScratchSize = buildSizes.updateScratchSize;
+    }
+
+    VkBufferCreateInfo bufferCreateInfo{};
+    bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferCreateInfo.size = size;
+    bufferCreateInfo.usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VmaAllocationCreateInfo allocCreateInfo{};
+    allocCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+    if (vmaCreateBuffer(allocator, &bufferCreateInfo, &allocCreateInfo, &buffer, &alloc, &allocInfo) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate acceleration structure memory");
+    }
+
+    VkAccelerationStructureCreateInfoKHR asCreateInfo{};
+    asCreateInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+    asCreateInfo.buffer = buffer;
+    asCreateInfo.size = size;
+    asCreateInfo.type = static_cast<VkAccelerationStructureTypeKHR>(createInfo->info.type);
+
+    if (vk_khr_acceleration_structure::vkCreateAccelerationStructureKHR(device, &asCreateInfo, nullptr, &as) != VK_SUCCESS) {
+        throw std::runtime_error("failed vkCreateAccelerationStructureKHR");
+    }
+}
+
+static void buildKHR(VkDevice device, VkCommandBuffer cmdBuffer, const VkAccelerationStructureInfoNV& infoNV, VkBuffer instanceBuffer, bool update, 
+    VkAccelerationStructureKHR as, VkBuffer scratchBuffer, VkDeviceSize scratchOffset) {
+    BuildInfoKHR buildInfo;
+    translateInfo(device, infoNV, instanceBuffer, buildInfo);
+
+    buildInfo.info.mode = update ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR : VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+    buildInfo.info.srcAccelerationStructure = update ? as : VK_NULL_HANDLE;
+    buildInfo.info.dstAccelerationStructure = as;
+    buildInfo.info.scratchData.deviceAddress = GetBufferAddress(device, scratchBuffer) + scratchOffset;
+
+    const VkAccelerationStructureBuildRangeInfoKHR* ranges = buildInfo.ranges.data();
+
+    vk_khr_acceleration_structure::vkCmdBuildAccelerationStructuresKHR(cmdBuffer, 1, &buildInfo.info, &ranges);
+}
+
+static void destroyKHR(VkDevice device, VmaAllocator allocator, VkAccelerationStructureKHR as, VkBuffer buffer, VmaAllocation alloc) {
+    vk_khr_acceleration_structure::vkDestroyAccelerationStructureKHR(device, as, nullptr);
+    vmaDestroyBuffer(allocator, buffer, alloc);
+}
+
 void BottomLevelAS::init(VkDevice device, VmaAllocator allocator, VkAccelerationStructureCreateInfoNV* createInfo) {
+    if (vk_khr_acceleration_structure::enabled) {
+        createKHR(device, allocator, createInfo, asKHR, buffer, alloc, allocInfo, scratchSize, updateScratchSize);
+
+        // instances reference bottom levels by device address
+        VkAccelerationStructureDeviceAddressInfoKHR addressInfo{};
+        addressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+        addressInfo.accelerationStructure = asKHR;
+
+        handle = vk_khr_acceleration_structure::vkGetAccelerationStructureDeviceAddressKHR(device, &addressInfo);
+        return;
+    }
+
     if (vk_nv_ray_tracing::vkCreateAccelerationStructureNV(device, createInfo, nullptr, &as) != VK_SUCCESS) {
         throw std::runtime_error("failed vkCreateAccelerationStructureNV");
     } else {
@@ -45,48 +185,145 @@ void BottomLevelAS::init(VkDevice device, VmaAllocator allocator, VkAcceleration
     }
 }
 
-void BottomLevelAS::record(VulkanDevice& device, VkAccelerationStructureCreateInfoNV* createInfo) {
-    // get the memory requirements for the scratch buffer
+static VkDeviceSize getScratchRequirements(VkDevice device, VkAccelerationStructureNV as, VkAccelerationStructureMemoryRequirementsTypeNV type) {
     VkAccelerationStructureMemoryRequirementsInfoNV scratchRequirementsInfo{};
     scratchRequirementsInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_INFO_NV;
-    scratchRequirementsInfo.type = VkAccelerationStructureMemoryRequirementsTypeNV::VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_BUILD_SCRATCH_NV;
+    scratchRequirementsInfo.type = type;
     scratchRequirementsInfo.accelerationStructure = as;
 
     VkMemoryRequirements2 scratchRequirements;
-    vk_nv_ray_tracing::vkGetAccelerationStructureMemoryRequirementsNV(device.device, &scratchRequirementsInfo, &scratchRequirements);
+    vk_nv_ray_tracing::vkGetAccelerationStructureMemoryRequirementsNV(device, &scratchRequirementsInfo, &scratchRequirements);
 
-    // create the scratch buffer
-    VkBufferCreateInfo scratchBufferInfo{};
-    scratchBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    scratchBufferInfo.size = scratchRequirements.memoryRequirements.size;
-    scratchBufferInfo.usage = VK_BUFFER_USAGE_RAY_TRACING_BIT_NV;
-    scratchBufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    return scratchRequirements.memoryRequirements.size;
+}
 
-    VmaAllocationCreateInfo allocCreateInfo{};
-    allocCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+VkDeviceSize BottomLevelAS::getScratchSize(VkDevice device) {
+    if (vk_khr_acceleration_structure::enabled) return scratchSize;
+
+    return getScratchRequirements(device, as, VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_BUILD_SCRATCH_NV);
+}
+
+VkDeviceSize BottomLevelAS::getUpdateScratchSize(VkDevice device) {
+    if (vk_khr_acceleration_structure::enabled) return updateScratchSize;
+
+    return getScratchRequirements(device, as, VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_UPDATE_SCRATCH_NV);
+}
+
+void BottomLevelAS::build(VkDevice device, VkCommandBuffer cmdBuffer, VkAccelerationStructureCreateInfoNV* createInfo, VkBuffer scratchBuffer, VkDeviceSize scratchOffset) {
+    if (vk_khr_acceleration_structure::enabled) {
+        buildKHR(device, cmdBuffer, createInfo->info, VK_NULL_HANDLE, false, asKHR, scratchBuffer, scratchOffset);
+        return;
+    }
+
+    vk_nv_ray_tracing::vkCmdBuildAccelerationStructureNV(cmdBuffer, &createInfo->info, VK_NULL_HANDLE, 0, VK_FALSE, as, VK_NULL_HANDLE, scratchBuffer, scratchOffset);
+}
+
+// refits in place, the structure has to be built with ALLOW_UPDATE and createInfo has to match the initial build
+void BottomLevelAS::update(VkDevice device, VkCommandBuffer cmdBuffer, VkAccelerationStructureCreateInfoNV* createInfo, VkBuffer scratchBuffer, VkDeviceSize scratchOffset) {
+    if (vk_khr_acceleration_structure::enabled) {
+        buildKHR(device, cmdBuffer, createInfo->info, VK_NULL_HANDLE, true, asKHR, scratchBuffer, scratchOffset);
+        return;
+    }
+
+    vk_nv_ray_tracing::vkCmdBuildAccelerationStructureNV(cmdBuffer, &createInfo->info, VK_NULL_HANDLE, 0, VK_TRUE, as, as, scratchBuffer, scratchOffset);
+}
+
+void BottomLevelAS::copy(VkCommandBuffer cmdBuffer, const BottomLevelAS& src, VkCopyAccelerationStructureModeNV mode) {
+    if (vk_khr_acceleration_structure::enabled) {
+        VkCopyAccelerationStructureInfoKHR copyInfo{};
+        copyInfo.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR;
+        copyInfo.src = src.asKHR;
+        copyInfo.dst = asKHR;
+        copyInfo.mode = static_cast<VkCopyAccelerationStructureModeKHR>(mode);
+
+        vk_khr_acceleration_structure::vkCmdCopyAccelerationStructureKHR(cmdBuffer, &copyInfo);
+        return;
+    }
+
+    vk_nv_ray_tracing::vkCmdCopyAccelerationStructureNV(cmdBuffer, as, src.as, mode);
+}
+
+void BottomLevelAS::serialize(VkCommandBuffer cmdBuffer, VkDeviceAddress dst) const {
+    VkCopyAccelerationStructureToMemoryInfoKHR copyInfo{};
+    copyInfo.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_TO_MEMORY_INFO_KHR;
+    copyInfo.src = asKHR;
+    copyInfo.dst.deviceAddress = dst;
+    copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_SERIALIZE_KHR;
+
+    vk_khr_acceleration_structure::vkCmdCopyAccelerationStructureToMemoryKHR(cmdBuffer, &copyInfo);
+}
+
+// the structure has to be created with the deserialized size stored in the header of the serialized data
+void BottomLevelAS::deserialize(VkCommandBuffer cmdBuffer, VkDeviceAddress src) {
+    VkCopyMemoryToAccelerationStructureInfoKHR copyInfo{};
+    copyInfo.sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_ACCELERATION_STRUCTURE_INFO_KHR;
+    copyInfo.src.deviceAddress = src;
+    copyInfo.dst = asKHR;
+    copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_DESERIALIZE_KHR;
+
+    vk_khr_acceleration_structure::vkCmdCopyMemoryToAccelerationStructureKHR(cmdBuffer, &copyInfo);
+}
+
+void BottomLevelAS::writeProperties(VkCommandBuffer cmdBuffer, const std::vector<const BottomLevelAS*>& structures, VkQueryType queryType, VkQueryPool queryPool) {
+    const uint32_t count = static_cast<uint32_t>(structures.size());
+
+    if (vk_khr_acceleration_structure::enabled) {
+        std::vector<VkAccelerationStructureKHR> handles(count);
+
+        for (uint32_t i = 0; i < count; i++) {
+            handles[i] = structures[i]->asKHR;
+        }
+
+        vk_khr_acceleration_structure::vkCmdWriteAccelerationStructuresPropertiesKHR(cmdBuffer, count, handles.data(), queryType, queryPool, 0);
+        return;
+    }
+
+    std::vector<VkAccelerationStructureNV> handles(count);
+
+    for (uint32_t i = 0; i < count; i++) {
+        handles[i] = structures[i]->as;
+    }
 
-    VkBuffer scratchBuffer;
-    VmaAllocation scratchBufferAlloc;
+    vk_nv_ray_tracing::vkCmdWriteAccelerationStructuresPropertiesNV(cmdBuffer, count, handles.data(), queryType, queryPool, 0);
+}
+
+VkQueryType BottomLevelAS::getCompactedSizeQueryType() {
+    return vk_khr_acceleration_structure::enabled ? VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR : VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_NV;
+}
 
-    vmaCreateBuffer(device.allocator, &scratchBufferInfo, &allocCreateInfo, &scratchBuffer, &scratchBufferAlloc, nullptr);
+void BottomLevelAS::record(VulkanDevice& device, VkAccelerationStructureCreateInfoNV* createInfo, ScratchArena& scratch) {
+    const VkDeviceSize scratchSize = getScratchSize(device.device);
+
+    scratch.reserve(device, scratchSize);
+    scratch.reset();
+
+    ScratchAllocation scratchAlloc;
+    scratch.allocate(scratchSize, scratchAlloc);
 
     // record the command buffer
     auto cmdBuffer = device.beginSingleTimeCommands();
 
-    vk_nv_ray_tracing::vkCmdBuildAccelerationStructureNV(cmdBuffer, &createInfo->info, VK_NULL_HANDLE, 0, VK_FALSE, as, VK_NULL_HANDLE, scratchBuffer, 0);
+    build(device.device, cmdBuffer, createInfo, scratchAlloc.buffer, scratchAlloc.offset);
 
     device.endSingleTimeCommands(cmdBuffer);
-
-    // destroy scratch buffer
-    vmaDestroyBuffer(device.allocator, scratchBuffer, scratchBufferAlloc);
 }
 
 void BottomLevelAS::destroy(VkDevice device, VmaAllocator allocator) {
+    if (vk_khr_acceleration_structure::enabled) {
+        destroyKHR(device, allocator, asKHR, buffer, alloc);
+        return;
+    }
+
     vk_nv_ray_tracing::vkDestroyAccelerationStructureNV(device, as, nullptr);
     vmaFreeMemory(allocator, alloc);
 }
 
 void TopLevelAS::init(VkDevice device, VmaAllocator allocator, VkAccelerationStructureCreateInfoNV* createInfo) {
+    if (vk_khr_acceleration_structure::enabled) {
+        createKHR(device, allocator, createInfo, asKHR, buffer, alloc, allocInfo, scratchSize, updateScratchSize);
+        return;
+    }
+
     if (vk_nv_ray_tracing::vkCreateAccelerationStructureNV(device, createInfo, nullptr, &as) != VK_SUCCESS) {
         throw std::runtime_error("failed to create vkaccelerationstructure for top level");
     }
@@ -120,63 +357,328 @@ void TopLevelAS::init(VkDevice device, VmaAllocator allocator, VkAccelerationStr
     }
 }
 
-void TopLevelAS::record(VulkanDevice& device, VkAccelerationStructureInstanceNV* instances, VkAccelerationStructureCreateInfoNV* createInfo) {
-    // create a host local buffer with all the instances
-    VkBuffer instancesBuffer;
-    VmaAllocation instancesBufferAlloc;
-    VmaAllocationInfo instancesBufferAllocInfo;
+// makes host writes to a range of instances visible to the device, a no-op for coherent memory
+static void flushInstances(VmaAllocator allocator, const TopLevelAS::InstanceBuffer& instanceBuffer, uint32_t begin, uint32_t end) {
+    if (begin >= end) return;
+
+    const VkDeviceSize stride = sizeof(VkAccelerationStructureInstanceNV);
+    vmaFlushAllocation(allocator, instanceBuffer.alloc, begin * stride, (end - begin) * stride);
+}
+
+void TopLevelAS::record(VulkanDevice& device, VkAccelerationStructureCreateInfoNV* createInfo, ScratchArena& scratch, const VkAccelerationStructureInstanceNV* filtered, bool update,
+    VkSemaphore waitSemaphore, uint64_t waitValue) {
+    // the instances of the build were written to the write slot, the previous build can still read its own
+    openWriteSlot(device);
+
+    activeSlot = getWriteSlot();
+    writeSlotOpen = false;
+
+    auto& slot = slots[activeSlot];
+
+    vkResetFences(device.device, 1, &slot.fence);
+
+    const uint32_t instanceCount = createInfo->info.instanceCount;
+
+    // the storage can't hold a filtered list, it's still the instance map's
+    if (filtered) {
+        SCATTER_ZONE("copy instances");
+
+        if (instanceCount > slot.filtered.capacity) {
+            growInstances(device, slot.filtered, std::max({ 64u, instanceCount, slot.filtered.capacity * 2 }), 0);
+        }
+
+        std::memcpy(slot.filtered.instances, filtered, instanceCount * sizeof(VkAccelerationStructureInstanceNV));
+        flushInstances(device.allocator, slot.filtered, 0, instanceCount);
+
+        slot.input = slot.filtered.buffer;
+    } else {
+        assert(instanceCount <= slot.storage.capacity);
+        slot.input = slot.storage.buffer;
+    }
+
+    // the filtered build doesn't read the storage, but the instance map already wrote to it
+    flushInstances(device.allocator, slot.storage, slot.writtenBegin, std::min(slot.writtenEnd, slot.storage.capacity));
 
+    slot.writtenBegin = UINT32_MAX;
+    slot.writtenEnd = 0;
+
+    // an update refits the existing structure in place (src == dst), which needs a lot less scratch memory
+    const VkDeviceSize scratchSize = update ? getUpdateScratchSize(device.device) : getScratchSize(device.device);
+
+    scratch.reserve(device, scratchSize);
+    scratch.reset();
+
+    ScratchAllocation scratchAlloc;
+    scratch.allocate(scratchSize, scratchAlloc);
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vkBeginCommandBuffer(slot.cmdBuffer, &beginInfo);
+
+    // wait for earlier builds on the queue, they write the bottom levels we reference and might share the scratch memory
+    AccelerationStructureBarrier(slot.cmdBuffer);
+
+    // the structure is written in place, earlier traces on the queue might still read it
+    TraceToBuildBarrier(slot.cmdBuffer);
+
+    const uint32_t scope = profiler ? profiler->begin(slot.cmdBuffer, GpuPass::TLAS_BUILD) : GpuProfiler::noScope;
+
+    if (vk_khr_acceleration_structure::enabled) {
+        buildKHR(device.device, slot.cmdBuffer, createInfo->info, slot.input, update, asKHR, scratchAlloc.buffer, scratchAlloc.offset);
+    } else {
+        vk_nv_ray_tracing::vkCmdBuildAccelerationStructureNV(slot.cmdBuffer, &createInfo->info, slot.input, 0, update ? VK_TRUE : VK_FALSE, 
+            as, update ? as : VK_NULL_HANDLE, scratchAlloc.buffer, scratchAlloc.offset);
+    }
+
+    if (profiler) {
+        profiler->end(slot.cmdBuffer, scope);
+    }
+
+    vkEndCommandBuffer(slot.cmdBuffer);
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &slot.cmdBuffer;
+
+    // bottom levels built on another queue are only visible after waiting on their timeline value
+    const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV;
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.waitSemaphoreValueCount = 1;
+    timelineInfo.pWaitSemaphoreValues = &waitValue;
+
+    if (waitSemaphore != VK_NULL_HANDLE) {
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = &waitSemaphore;
+        submitInfo.pWaitDstStageMask = &waitStage;
+    }
+
+    // no need to wait, the trace is submitted to the same queue and synchronizes using a barrier
+    {
+        SCATTER_ZONE("submit top level build");
+
+        if (vkQueueSubmit(device.graphicsQueue, 1, &submitInfo, slot.fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit top level build");
+        }
+    }
+
+    slot.pending = true;
+}
+
+// refits with the instances of the last record, used when only the bottom levels changed.
+// Without update the structure is rebuilt in place instead, which needs the full build scratch size
+void TopLevelAS::refit(VkDevice device, VkCommandBuffer cmdBuffer, VkAccelerationStructureCreateInfoNV* createInfo, VkBuffer scratchBuffer, VkDeviceSize scratchOffset, uint64_t frame, bool update) {
+    slots[activeSlot].readFrame = frame;
+
+    if (vk_khr_acceleration_structure::enabled) {
+        buildKHR(device, cmdBuffer, createInfo->info, slots[activeSlot].input, update, asKHR, scratchBuffer, scratchOffset);
+        return;
+    }
+
+    vk_nv_ray_tracing::vkCmdBuildAccelerationStructureNV(cmdBuffer, &createInfo->info, slots[activeSlot].input, 0, update ? VK_TRUE : VK_FALSE, 
+        as, update ? as : VK_NULL_HANDLE, scratchBuffer, scratchOffset);
+}
+
+void TopLevelAS::wait(VkDevice device) {
+    for (auto& slot : slots) {
+        if (slot.pending) {
+            vkWaitForFences(device, 1, &slot.fence, VK_TRUE, UINT64_MAX);
+            slot.pending = false;
+        }
+    }
+}
+
+void TopLevelAS::setSlotCount(uint32_t count) {
+    assert(count > 0 && std::all_of(slots.begin(), slots.end(), [](const InstanceSlot& slot) { return slot.fence == VK_NULL_HANDLE; }));
+
+    // refits in between builds read the slot built last, while the instance map already writes the next one
+    slots.resize(std::max(count, 2u));
+    activeSlot = 0;
+    writeSlotOpen = false;
+}
+
+void TopLevelAS::setFrameCallbacks(FrameWait wait, BufferRelease release) {
+    frameWait = std::move(wait);
+    bufferRelease = std::move(release);
+}
+
+VkAccelerationStructureInstanceNV* TopLevelAS::acquireInstances(VulkanDevice& device, uint32_t capacity) {
+    openWriteSlot(device);
+
+    auto& slot = slots[getWriteSlot()];
+    InstanceBuffer& storage = slot.storage;
+
+    if (capacity > storage.capacity) {
+        // everything kept is written to the new buffer
+        slot.writtenBegin = 0;
+        slot.writtenEnd = std::max(slot.writtenEnd, storage.capacity);
+
+        growInstances(device, storage, std::max({ 64u, capacity, storage.capacity * 2 }), storage.capacity);
+    }
+
+    return storage.instances;
+}
+
+void TopLevelAS::openWriteSlot(VulkanDevice& device) {
+    if (writeSlotOpen) return;
+
+    auto& slot = slots[getWriteSlot()];
+    const auto& source = slots[activeSlot].storage;
+
+    if (slot.fence == VK_NULL_HANDLE) {
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        vkCreateFence(device.device, &fenceInfo, nullptr, &slot.fence);
+
+        slot.cmdBuffer = device.createCommandBuffer();
+    }
+
+    // normally signaled long ago, the slot was built a ring of frames back
+    if (slot.pending) {
+        SCATTER_ZONE("wait for instance slot");
+        vkWaitForFences(device.device, 1, &slot.fence, VK_TRUE, UINT64_MAX);
+        slot.pending = false;
+    }
+
+    // submit may have refit from the slot after its build
+    if (slot.readFrame > 0) {
+        assert(frameWait);
+
+        SCATTER_ZONE("wait for instance slot frame");
+        frameWait(slot.readFrame);
+        slot.readFrame = 0;
+    }
+
+    if (slot.storage.capacity < std::max(source.capacity, 64u)) {
+        growInstances(device, slot.storage, std::max(source.capacity, 64u), 0);
+
+        slot.dirtyBegin = 0;
+        slot.dirtyEnd = UINT32_MAX;
+    }
+
+    // catch up on what was written while the other slots were open, the slot built last has all of it
+    const uint32_t dirtyEnd = std::min(slot.dirtyEnd, source.capacity);
+
+    if (slot.dirtyBegin < dirtyEnd) {
+        SCATTER_ZONE("copy instances");
+        std::memcpy(slot.storage.instances + slot.dirtyBegin, source.instances + slot.dirtyBegin, (dirtyEnd - slot.dirtyBegin) * sizeof(VkAccelerationStructureInstanceNV));
+
+        slot.writtenBegin = std::min(slot.writtenBegin, slot.dirtyBegin);
+        slot.writtenEnd = std::max(slot.writtenEnd, dirtyEnd);
+    }
+
+    slot.dirtyBegin = UINT32_MAX;
+    slot.dirtyEnd = 0;
+
+    writeSlotOpen = true;
+}
+
+void TopLevelAS::invalidate(uint32_t begin, uint32_t end) {
+    if (begin >= end) return;
+
+    const uint32_t writeSlot = getWriteSlot();
+
+    for (uint32_t i = 0; i < slots.size(); i++) {
+        if (i == writeSlot) {
+            slots[i].writtenBegin = std::min(slots[i].writtenBegin, begin);
+            slots[i].writtenEnd = std::max(slots[i].writtenEnd, end);
+            continue;
+        }
+
+        slots[i].dirtyBegin = std::min(slots[i].dirtyBegin, begin);
+        slots[i].dirtyEnd = std::max(slots[i].dirtyEnd, end);
+    }
+}
+
+void TopLevelAS::growInstances(VulkanDevice& device, InstanceBuffer& instanceBuffer, uint32_t capacity, uint32_t keep) {
     VkBufferCreateInfo instanceBufferCreateInfo{};
     instanceBufferCreateInfo.sType = VkStructureType::VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    instanceBufferCreateInfo.size = createInfo->info.instanceCount * sizeof(VkAccelerationStructureInstanceNV);
-    instanceBufferCreateInfo.usage = VkBufferUsageFlagBits::VK_BUFFER_USAGE_RAY_TRACING_BIT_NV;
+    instanceBufferCreateInfo.size = capacity * sizeof(VkAccelerationStructureInstanceNV);
+    instanceBufferCreateInfo.usage = GetBuildInputUsage();
     instanceBufferCreateInfo.sharingMode = VkSharingMode::VK_SHARING_MODE_EXCLUSIVE;
 
+    // the instance map reads its instances back from here, so cached memory is preferred
     VmaAllocationCreateInfo instanceBufferAllocCreateInfo{};
     instanceBufferAllocCreateInfo.flags = VmaAllocationCreateFlagBits::VMA_ALLOCATION_CREATE_MAPPED_BIT;
     instanceBufferAllocCreateInfo.usage = VmaMemoryUsage::VMA_MEMORY_USAGE_CPU_ONLY;
+    instanceBufferAllocCreateInfo.preferredFlags = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
 
-    if (vmaCreateBuffer(device.allocator, &instanceBufferCreateInfo, &instanceBufferAllocCreateInfo, &instancesBuffer, &instancesBufferAlloc,
-        &instancesBufferAllocInfo) != VK_SUCCESS) throw std::runtime_error("failed to create instanceBuffer");
+    InstanceBuffer grown;
+    VmaAllocationInfo allocInfo;
 
-    std::memcpy(instancesBufferAllocInfo.pMappedData, instances, instanceBufferCreateInfo.size);
+    if (vmaCreateBuffer(device.allocator, &instanceBufferCreateInfo, &instanceBufferAllocCreateInfo, &grown.buffer, &grown.alloc, &allocInfo) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create instanceBuffer");
+    }
 
-    // get the memory requirements for the scratch buffer
-    VkAccelerationStructureMemoryRequirementsInfoNV scratchRequirementsInfo{};
-    scratchRequirementsInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_INFO_NV;
-    scratchRequirementsInfo.type = VkAccelerationStructureMemoryRequirementsTypeNV::VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_BUILD_SCRATCH_NV;;
-    scratchRequirementsInfo.accelerationStructure = as;
+    grown.instances = static_cast<VkAccelerationStructureInstanceNV*>(allocInfo.pMappedData);
+    grown.capacity = capacity;
 
-    VkMemoryRequirements2 scratchRequirements;
-    vk_nv_ray_tracing::vkGetAccelerationStructureMemoryRequirementsNV(device.device, &scratchRequirementsInfo, &scratchRequirements);
+    if (instanceBuffer.buffer != VK_NULL_HANDLE) {
+        if (keep > 0) {
+            std::memcpy(grown.instances, instanceBuffer.instances, std::min(keep, capacity) * sizeof(VkAccelerationStructureInstanceNV));
+        }
 
-    // create the scratch buffer
-    VkBufferCreateInfo scratchBufferInfo{};
-    scratchBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    scratchBufferInfo.size = scratchRequirements.memoryRequirements.size;
-    scratchBufferInfo.usage = VK_BUFFER_USAGE_RAY_TRACING_BIT_NV;
-    scratchBufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        releaseInstances(device, instanceBuffer);
+    }
 
-    VmaAllocationCreateInfo allocCreateInfo{};
-    allocCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+    instanceBuffer = grown;
+}
 
-    VkBuffer scratchBuffer;
-    VmaAllocation scratchBufferAlloc;
+void TopLevelAS::releaseInstances(VulkanDevice& device, InstanceBuffer& instanceBuffer) {
+    if (bufferRelease) {
+        bufferRelease(instanceBuffer.buffer, instanceBuffer.alloc);
+    } else {
+        vmaDestroyBuffer(device.allocator, instanceBuffer.buffer, instanceBuffer.alloc);
+    }
 
-    vmaCreateBuffer(device.allocator, &scratchBufferInfo, &allocCreateInfo, &scratchBuffer, &scratchBufferAlloc, nullptr);
+    instanceBuffer = InstanceBuffer();
+}
 
-    auto cmdBuffer = device.beginSingleTimeCommands();
+void TopLevelAS::destroyInstances(VulkanDevice& device) {
+    wait(device.device);
 
-    vk_nv_ray_tracing::vkCmdBuildAccelerationStructureNV(cmdBuffer, &createInfo->info, instancesBuffer, 0, VK_FALSE, as, VK_NULL_HANDLE, scratchBuffer, 0);
+    for (auto& slot : slots) {
+        for (InstanceBuffer* instanceBuffer : { &slot.storage, &slot.filtered }) {
+            if (instanceBuffer->buffer != VK_NULL_HANDLE) {
+                vmaDestroyBuffer(device.allocator, instanceBuffer->buffer, instanceBuffer->alloc);
+            }
+        }
 
-    device.endSingleTimeCommands(cmdBuffer);
+        if (slot.fence != VK_NULL_HANDLE) {
+            vkDestroyFence(device.device, slot.fence, nullptr);
+            vkFreeCommandBuffers(device.device, device.commandPool, 1, &slot.cmdBuffer);
+        }
+
+        slot = InstanceSlot();
+    }
+
+    activeSlot = 0;
+    writeSlotOpen = false;
+}
+
+VkDeviceSize TopLevelAS::getScratchSize(VkDevice device) {
+    if (vk_khr_acceleration_structure::enabled) return scratchSize;
 
-    // cleanup buffers
-    vmaDestroyBuffer(device.allocator, scratchBuffer, scratchBufferAlloc);
-    vmaDestroyBuffer(device.allocator, instancesBuffer, instancesBufferAlloc);
+    return getScratchRequirements(device, as, VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_BUILD_SCRATCH_NV);
+}
+
+VkDeviceSize TopLevelAS::getUpdateScratchSize(VkDevice device) {
+    if (vk_khr_acceleration_structure::enabled) return updateScratchSize;
+
+    return getScratchRequirements(device, as, VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_UPDATE_SCRATCH_NV);
 }
 
 void TopLevelAS::destroy(VkDevice device, VmaAllocator allocator) {
+    if (vk_khr_acceleration_structure::enabled) {
+        destroyKHR(device, allocator, asKHR, buffer, alloc);
+        return;
+    }
+
     vk_nv_ray_tracing::vkDestroyAccelerationStructureNV(device, as, nullptr);
     vmaFreeMemory(allocator, alloc);
 }
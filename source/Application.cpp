@@ -85,7 +85,7 @@ void VulkanApplication::init(uint32_t width, uint32_t height) {
     BLAScreateInfo.info.pGeometries = geometries.data();
 
     bottomLevelAS.init(device.device, device.allocator, &BLAScreateInfo);
-    bottomLevelAS.record(device, &BLAScreateInfo);
+    bottomLevelAS.record(device, &BLAScreateInfo, scratchArena);
 
     // create top level acceleration structure
     VkAccelerationStructureCreateInfoNV TLAScreateInfo{};
@@ -110,13 +110,17 @@ void VulkanApplication::init(uint32_t width, uint32_t height) {
     auto transform = glm::mat4(1.0f);
     std::memcpy(&instance.transform, glm::value_ptr(transform), sizeof(VkTransformMatrixKHR));
 
+    // the instance is written straight into the buffer the build reads
+    *topLevelAS.acquireInstances(device, 1) = instance;
+    topLevelAS.invalidate(0, 1);
+
     topLevelAS.init(device.device, device.allocator, &TLAScreateInfo);
-    topLevelAS.record(device, &instance, &TLAScreateInfo);
+    topLevelAS.record(device, &TLAScreateInfo, scratchArena);
 
     // set uniform data
     renderSequence.uniforms.projection = glm::perspectiveRH(glm::radians(75.0f), 16.0f / 9.0f, 0.1f, 100.0f);
     renderSequence.uniforms.view = glm::lookAtRH(glm::vec3(2, 4, -5), glm::vec3(0, 0, 0), { 0, 1, 0 });
-    shadowSequence.pushData.inverseViewProjection = glm::inverse(renderSequence.uniforms.projection * renderSequence.uniforms.view);
+    shadowSequence.uniforms.inverseViewProjection = glm::inverse(renderSequence.uniforms.projection * renderSequence.uniforms.view);
     
     // init both render sequences
     shadowSequence.init(device.device, device.allocator, device.physicalDevice, shaderManager);
@@ -139,6 +143,9 @@ void VulkanApplication::init(uint32_t width, uint32_t height) {
     device.commandBuffers.resize(renderSequence.getFramebuffersCount());
     device.createCommandBuffers();
 
+    // the command buffers are recorded once per swapchain image, so are the timestamp queries
+    gpuProfiler.init(device, static_cast<uint32_t>(device.commandBuffers.size()));
+
     // record command buffers
     for (size_t i = 0; i < device.commandBuffers.size(); i++) {
         VkCommandBufferBeginInfo beginInfo{};
@@ -161,8 +168,15 @@ void VulkanApplication::init(uint32_t width, uint32_t height) {
 
         vkGetPhysicalDeviceProperties2(device.physicalDevice, &pdProps);
 
+        const uint32_t frame = static_cast<uint32_t>(i);
+
+        gpuProfiler.beginRecorded(device.commandBuffers[i], frame, GpuPass::RASTER);
         renderSequence.execute(device.device, device.commandBuffers[i], device.allocator, extent, vertexBuffer.getBuffer(), indexBuffer.getBuffer(), objects, i);
+        gpuProfiler.endRecorded(device.commandBuffers[i], frame, GpuPass::RASTER);
+
+        gpuProfiler.beginRecorded(device.commandBuffers[i], frame, GpuPass::SHADOW_TRACE);
         shadowSequence.execute(device.device, device.commandBuffers[i], extent.width, extent.height, rtProps);
+        gpuProfiler.endRecorded(device.commandBuffers[i], frame, GpuPass::SHADOW_TRACE);
 
         if (vkEndCommandBuffer(device.commandBuffers[i]) != VK_SUCCESS) {
             throw std::runtime_error("failed to record command buffer! \n");
@@ -176,7 +190,10 @@ void VulkanApplication::destroy() {
     vertexBuffer.destroy(device);
     indexBuffer.destroy(device);
     bottomLevelAS.destroy(device.device, device.allocator);
+    topLevelAS.destroyInstances(device);
     topLevelAS.destroy(device.device, device.allocator);
+    scratchArena.trim(device);
+    gpuProfiler.destroy(device.device);
 
     for (size_t i = 0; i < MAX_FRAME_IN_FLIGHT; i++) {
         vkDestroySemaphore(device.device, imageAvailableSemaphore[i], nullptr);
@@ -247,7 +264,8 @@ void VulkanApplication::update(float dt) {
         }
 
         dt = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t1).count() / 1000;
-        std::string title = "Scatter - " + std::to_string(int(1.0f / dt)) + " fps";
+        std::string title = "Scatter - " + std::to_string(int(1.0f / dt)) + " fps - raster " + std::to_string(gpuProfiler.getTiming(GpuPass::RASTER).avg) + 
+            " ms - shadows " + std::to_string(gpuProfiler.getTiming(GpuPass::SHADOW_TRACE).avg) + " ms";
         glfwSetWindowTitle(window, title.c_str());
     }
 
@@ -272,7 +290,10 @@ void VulkanApplication::drawFrame() {
     if (imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
         vkWaitForFences(device.device, 1, &imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
     }
-    imagesInFlight[currentFrame] = inFlightFences[currentFrame];
+    imagesInFlight[imageIndex] = inFlightFences[currentFrame];
+
+    // the image's last frame is done, so are its timestamps
+    gpuProfiler.beginFrame(device.device, imageIndex);
 
     VkSubmitInfo submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -352,6 +373,10 @@ void VulkanApplication::recreateSwapChain() {
     device.commandBuffers.resize(renderSequence.getFramebuffersCount());
     device.createCommandBuffers();
 
+    // the queries are recreated for the new images, the statistics are kept
+    gpuProfiler.destroy(device.device);
+    gpuProfiler.init(device, static_cast<uint32_t>(device.commandBuffers.size()));
+
     VkPhysicalDeviceRayTracingPropertiesNV rtProps{};
     rtProps.sType = VkStructureType::VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PROPERTIES_NV;
 
@@ -374,8 +399,15 @@ void VulkanApplication::recreateSwapChain() {
 
         const auto extent = swapchain.swapChainExtent;
 
+        const uint32_t frame = static_cast<uint32_t>(i);
+
+        gpuProfiler.beginRecorded(device.commandBuffers[i], frame, GpuPass::RASTER);
         renderSequence.execute(device.device, device.commandBuffers[i], device.allocator, extent, vertexBuffer.getBuffer(), indexBuffer.getBuffer(), objects, i);
+        gpuProfiler.endRecorded(device.commandBuffers[i], frame, GpuPass::RASTER);
+
+        gpuProfiler.beginRecorded(device.commandBuffers[i], frame, GpuPass::SHADOW_TRACE);
         shadowSequence.execute(device.device, device.commandBuffers[i], extent.width, extent.height, rtProps);
+        gpuProfiler.endRecorded(device.commandBuffers[i], frame, GpuPass::SHADOW_TRACE);
 
         if (vkEndCommandBuffer(device.commandBuffers[i]) != VK_SUCCESS) {
             throw std::runtime_error("failed to record command buffer! \n");
@@ -0,0 +1,465 @@
+#include "pch.h"
+#include "Benchmark.h"
+#include "Vertex.h"
+
+#include <chrono>
+#include <iomanip>
+#include <random>
+#include <thread>
+
+namespace scatter {
+
+static void printTiming(const char* name, const PassTiming& timing) {
+    std::cout << "  " << name << " avg " << timing.avg << " ms, p99 " << timing.p99 << " ms over " << timing.sampleCount << " runs\n";
+}
+
+void Benchmark::init(uint32_t width, uint32_t height) {
+    this->width = width;
+    this->height = height;
+
+    // the instance extensions come from glfw, even without a window
+    glfwInit();
+
+    device.init(RayTracingExtension::AUTO);
+    sphere.createSphere(1.0f);
+}
+
+void Benchmark::run() {
+    std::cout << std::fixed << std::setprecision(3);
+
+    measureSubmit();
+    compareMeshRegistration();
+    compareInstanceSorting();
+    compareBuildPreferences();
+    compareStaticBatching();
+}
+
+void Benchmark::destroy() {
+    device.destroy();
+    glfwTerminate();
+}
+
+void Benchmark::measureSubmit() {
+    Scatter scatter;
+    initScatter(scatter);
+
+    addSphereGrid(scatter, { addSphere(scatter) }, 1000, false);
+    scatter.build();
+
+    // the first frame of every slot records the trace
+    traceFrames(scatter, framesInFlight, false);
+
+    const double reused = traceFrames(scatter, frameCount, false);
+    const double recorded = traceFrames(scatter, frameCount, true);
+
+    std::cout << "submit CPU time, " << frameCount << " frames\n";
+    std::cout << "  reused recording:   " << reused << " us\n";
+    std::cout << "  recorded per frame: " << recorded << " us\n";
+
+    scatter.destroy();
+}
+
+void Benchmark::compareMeshRegistration() {
+    constexpr uint32_t meshCount = 256;
+
+    MeshDescription description;
+    description.vertices = sphere.vertices.data();
+    description.indices = sphere.indices.data();
+    description.vertexCount = static_cast<unsigned int>(sphere.vertices.size());
+    description.indexCount = static_cast<unsigned int>(sphere.indices.size());
+
+    const std::vector<MeshDescription> descriptions(meshCount, description);
+
+    // both block until the structures are built, so the wall time covers the upload and the build
+    double single, batched;
+
+    {
+        Scatter scatter;
+        initScatter(scatter);
+
+        const auto begin = std::chrono::steady_clock::now();
+
+        for (uint32_t i = 0; i < meshCount; i++) {
+            addSphere(scatter);
+        }
+
+        single = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+        scatter.destroy();
+    }
+
+    {
+        Scatter scatter;
+        initScatter(scatter);
+
+        std::vector<uint64_t> meshes(meshCount);
+
+        const auto begin = std::chrono::steady_clock::now();
+        scatter.addMeshes(descriptions.data(), meshCount, meshes.data());
+        batched = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+        scatter.destroy();
+    }
+
+    std::cout << "mesh registration, " << meshCount << " meshes
+";
+    std::cout << "  addMesh per mesh: " << single << " ms
+";
+    std::cout << "  addMeshes:        " << batched << " ms
+";
+    std::cout << "  ratio:            " << single / batched << "x
+";
+}
+
+void Benchmark::compareInstanceSorting() {
+    for (const bool sorted : { false, true }) {
+        Scatter scatter;
+        initScatter(scatter);
+
+        scatter.setInstanceSorting(sorted);
+        addSphereGrid(scatter, { addSphere(scatter) }, 100000, true);
+        scatter.build();
+
+        traceFrames(scatter, frameCount, false);
+
+        const GpuTimings timings = scatter.getGpuTimings();
+
+        std::cout << (sorted ? "sorted" : "unsorted") << " instances, 100000 shuffled\n";
+        printTiming("shadow trace", timings.shadowTrace);
+        printTiming("tlas build  ", timings.tlasBuild);
+
+        scatter.destroy();
+    }
+}
+
+void Benchmark::compareBuildPreferences() {
+    const std::pair<BuildPreference, const char*> preferences[] = {
+        { BuildPreference::NONE, "none" },
+        { BuildPreference::PREFER_FAST_TRACE, "fast trace" },
+        { BuildPreference::PREFER_FAST_BUILD, "fast build" },
+        { BuildPreference::LOW_MEMORY, "low memory" },
+        { BuildPreference::ALLOW_COMPACTION, "compaction" },
+        { BuildPreference::PREFER_FAST_TRACE | BuildPreference::ALLOW_COMPACTION, "fast trace and compaction" }
+    };
+
+    // every call is a single timed build, so they're split up to get a few samples
+    constexpr uint32_t callCount = 16;
+    constexpr uint32_t meshesPerCall = 16;
+
+    MeshDescription description;
+    description.vertices = sphere.vertices.data();
+    description.indices = sphere.indices.data();
+    description.vertexCount = static_cast<unsigned int>(sphere.vertices.size());
+    description.indexCount = static_cast<unsigned int>(sphere.indices.size());
+
+    const std::vector<MeshDescription> descriptions(meshesPerCall, description);
+
+    for (const auto& [preference, name] : preferences) {
+        Scatter scatter;
+        initScatter(scatter);
+
+        scatter.setBuildPreference(preference);
+
+        std::vector<uint64_t> meshes(callCount * meshesPerCall);
+
+        for (uint32_t call = 0; call < callCount; call++) {
+            scatter.addMeshes(descriptions.data(), meshesPerCall, meshes.data() + call * meshesPerCall);
+        }
+
+        addSphereGrid(scatter, meshes, 10000, false);
+        scatter.build();
+
+        traceFrames(scatter, frameCount, false);
+
+        size_t buildSize = 0, size = 0;
+
+        for (uint64_t mesh : meshes) {
+            const MeshMemoryStats stats = scatter.getMeshMemoryStats(mesh);
+            buildSize += stats.buildSize;
+            size += stats.size;
+        }
+
+        const GpuTimings timings = scatter.getGpuTimings();
+
+        std::cout << "build preference " << name << ", " << meshes.size() << " meshes\n";
+        printTiming("blas build  ", timings.blasBuild);
+        printTiming("shadow trace", timings.shadowTrace);
+        std::cout << "  built " << buildSize << " bytes, " << size << " bytes after compaction, "
+            << scatter.getScratchStats().highWaterMark << " bytes of scratch for the largest build\n";
+
+        scatter.destroy();
+    }
+}
+
+void Benchmark::compareStaticBatching() {
+    MeshDescription description;
+    description.vertices = sphere.vertices.data();
+    description.indices = sphere.indices.data();
+    description.vertexCount = static_cast<unsigned int>(sphere.vertices.size());
+    description.indexCount = static_cast<unsigned int>(sphere.indices.size());
+    description.batchable = true;
+
+    // baking in a Scatter of its own, so the timings before baking don't end up in the history after it
+    for (const bool baked : { false, true }) {
+        Scatter scatter;
+        initScatter(scatter);
+
+        uint64_t mesh;
+        scatter.addMeshes(&description, 1, &mesh);
+
+        const std::vector<uint64_t> instances = addSphereGrid(scatter, { mesh }, 50000, false);
+
+        for (uint64_t instance : instances) {
+            scatter.markStatic(instance);
+        }
+
+        // a cell is an eighth of the grid along every axis
+        const StaticBatchStats stats = baked ? scatter.bakeStatic(0.25f) : StaticBatchStats();
+        scatter.build();
+
+        traceFrames(scatter, frameCount, false);
+
+        const GpuTimings timings = scatter.getGpuTimings();
+
+        if (baked) {
+            std::cout << "static batching, baked " << stats.bakedInstanceCount << " instances into " << stats.batchCount << " batches, "
+                << stats.instanceCountBefore << " instances before and " << stats.instanceCountAfter << " after\n";
+        } else {
+            std::cout << "static batching, " << instances.size() << " instances without baking\n";
+        }
+
+        printTiming("shadow trace", timings.shadowTrace);
+        printTiming("tlas build  ", timings.tlasBuild);
+
+        scatter.destroy();
+    }
+}
+
+void Benchmark::initScatter(Scatter& scatter) {
+    scatter.setFramesInFlight(framesInFlight);
+    scatter.setTimelineSemaphores(true);
+    scatter.init();
+    scatter.createTextures(width, height);
+
+    scatter.setVertexStride(sizeof(Vertex));
+    scatter.setVertexOffset(offsetof(Vertex, pos));
+    scatter.setVertexFormat(VertexFormat::R32G32B32_SFLOAT);
+    scatter.setIndexFormat(IndexFormat::UINT16);
+
+    // with the identity matrix the cleared depth is the z = 0 plane in world space, shadow rays go towards positive z
+    scatter.setLightDirection(0.0f, 0.0f, -1.0f);
+    clearDepth(scatter, 0.5f);
+}
+
+void Benchmark::clearDepth(Scatter& scatter, float depth) {
+    // the same image Scatter exported, or the memory can't be imported
+    VkExternalMemoryImageCreateInfo externalInfo = {};
+    externalInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO;
+    externalInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_WIN32_BIT;
+
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.pNext = &externalInfo;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent = { width, height, 1 };
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = VK_FORMAT_D32_SFLOAT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VkImage image;
+    if (vkCreateImage(device.device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create depth image");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(device.device, image, &memRequirements);
+
+    VkPhysicalDeviceMemoryProperties memProperties;
+    vkGetPhysicalDeviceMemoryProperties(device.physicalDevice, &memProperties);
+
+    // picked the same way the exported memory was
+    uint32_t memoryType = UINT32_MAX;
+
+    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+        if ((memRequirements.memoryTypeBits & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)) {
+            memoryType = i;
+            break;
+        }
+    }
+
+    if (memoryType == UINT32_MAX) {
+        throw std::runtime_error("failed to find suitable memory type!");
+    }
+
+    // importing doesn't take ownership of the handle
+    HANDLE handle = scatter.getDepthTextureMemoryhandle();
+
+    VkImportMemoryWin32HandleInfoKHR importInfo = {};
+    importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_WIN32_HANDLE_INFO_KHR;
+    importInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_WIN32_BIT;
+    importInfo.handle = handle;
+
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.pNext = &importInfo;
+    allocInfo.allocationSize = scatter.getDepthTextureMemorySize();
+    allocInfo.memoryTypeIndex = memoryType;
+
+    VkDeviceMemory memory;
+    const VkResult importResult = vkAllocateMemory(device.device, &allocInfo, nullptr, &memory);
+    CloseHandle(handle);
+
+    if (importResult != VK_SUCCESS) {
+        throw std::runtime_error("failed to import depth memory");
+    }
+
+    if (vkBindImageMemory(device.device, image, memory, 0) != VK_SUCCESS) {
+        throw std::runtime_error("failed to bind memory to texture");
+    }
+
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = VK_FORMAT_D32_SFLOAT;
+    viewInfo.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+
+    VkImageView view;
+    if (vkCreateImageView(device.device, &viewInfo, nullptr, &view) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create depth image view");
+    }
+
+    // the image can't be a transfer destination, it has to be the usage Scatter exported, so it's cleared by a render pass
+    VkAttachmentDescription depthAttachment = {};
+    depthAttachment.format = VK_FORMAT_D32_SFLOAT;
+    depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkAttachmentReference depthAttachmentRef = {};
+    depthAttachmentRef.attachment = 0;
+    depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription subpass = {};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+    VkRenderPassCreateInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.attachmentCount = 1;
+    renderPassInfo.pAttachments = &depthAttachment;
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+
+    VkRenderPass renderPass;
+    if (vkCreateRenderPass(device.device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create render pass!");
+    }
+
+    VkFramebufferCreateInfo framebufferInfo = {};
+    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebufferInfo.renderPass = renderPass;
+    framebufferInfo.attachmentCount = 1;
+    framebufferInfo.pAttachments = &view;
+    framebufferInfo.width = width;
+    framebufferInfo.height = height;
+    framebufferInfo.layers = 1;
+
+    VkFramebuffer framebuffer;
+    if (vkCreateFramebuffer(device.device, &framebufferInfo, nullptr, &framebuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create framebuffer!");
+    }
+
+    VkClearValue clearValue = {};
+    clearValue.depthStencil = { depth, 0 };
+
+    VkRenderPassBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    beginInfo.renderPass = renderPass;
+    beginInfo.framebuffer = framebuffer;
+    beginInfo.renderArea = { { 0, 0 }, { width, height } };
+    beginInfo.clearValueCount = 1;
+    beginInfo.pClearValues = &clearValue;
+
+    // waits for the clear, Scatter reads the memory on a queue of its own
+    VkCommandBuffer cmdBuffer = device.beginSingleTimeCommands();
+    vkCmdBeginRenderPass(cmdBuffer, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdEndRenderPass(cmdBuffer);
+    device.endSingleTimeCommands(cmdBuffer);
+
+    vkDestroyFramebuffer(device.device, framebuffer, nullptr);
+    vkDestroyRenderPass(device.device, renderPass, nullptr);
+    vkDestroyImageView(device.device, view, nullptr);
+    vkDestroyImage(device.device, image, nullptr);
+    vkFreeMemory(device.device, memory, nullptr);
+}
+
+uint64_t Benchmark::addSphere(Scatter& scatter) {
+    return scatter.addMesh(sphere.vertices.data(), sphere.indices.data(),
+        static_cast<unsigned int>(sphere.vertices.size()), static_cast<unsigned int>(sphere.indices.size()));
+}
+
+std::vector<uint64_t> Benchmark::addSphereGrid(Scatter& scatter, const std::vector<uint64_t>& meshes, uint32_t count, bool shuffle) {
+    const uint32_t side = static_cast<uint32_t>(std::ceil(std::cbrt(static_cast<double>(count))));
+    const float spacing = 2.0f / side;
+
+    std::vector<glm::mat4> transforms;
+    transforms.reserve(count);
+
+    // covers the screen in x and y, the rays start at z = 0
+    for (uint32_t i = 0; i < count; i++) {
+        const glm::vec3 cell = glm::vec3(i % side, (i / side) % side, i / (side * side)) + 0.5f;
+        const glm::vec3 position = glm::vec3(-1.0f, -1.0f, 0.1f) + cell * spacing;
+
+        transforms.push_back(glm::scale(glm::translate(glm::mat4(1.0f), position), glm::vec3(spacing * 0.4f)));
+    }
+
+    if (shuffle) {
+        std::shuffle(transforms.begin(), transforms.end(), std::mt19937(1337));
+    }
+
+    std::vector<uint64_t> instanceMeshes(count);
+    std::vector<uint64_t> handles(count);
+
+    for (uint32_t i = 0; i < count; i++) {
+        instanceMeshes[i] = meshes[i % meshes.size()];
+    }
+
+    scatter.addInstances(glm::value_ptr(transforms[0]), instanceMeshes.data(), count, MatrixLayout::COLUMN_MAJOR, handles.data());
+
+    return handles;
+}
+
+double Benchmark::traceFrames(Scatter& scatter, uint32_t count, bool rerecord) {
+    std::chrono::nanoseconds total(0);
+
+    for (uint32_t frame = 0; frame < count; frame++) {
+        while (scatter.getFrameLatency() > 0) {
+            std::this_thread::yield();
+        }
+
+        const uint32_t frameHeight = rerecord ? height - frame % (framesInFlight + 1) : height;
+
+        // the ready semaphore is never signaled, waiting for zero doesn't wait
+        const auto begin = std::chrono::steady_clock::now();
+        scatter.submit(width, frameHeight, 0);
+        total += std::chrono::steady_clock::now() - begin;
+    }
+
+    while (scatter.getFrameLatency() > 0) {
+        std::this_thread::yield();
+    }
+
+    return std::chrono::duration<double, std::micro>(total).count() / count;
+}
+
+} // scatter
@@ -0,0 +1,130 @@
+#include "pch.h"
+#include "CpuTrace.h"
+
+#include <iomanip>
+#include <memory>
+#include <mutex>
+
+namespace scatter {
+
+struct ZoneEvent {
+    const char* name;
+    uint64_t begin;
+    uint64_t end;
+};
+
+// zones of a single thread, the oldest are overwritten once the ring is full. The lock is only contended while a trace is written
+struct ThreadTrace {
+    static constexpr size_t capacity = 1 << 14;
+
+    std::mutex mutex;
+    std::vector<ZoneEvent> events = std::vector<ZoneEvent>(capacity);
+    uint64_t written = 0;
+    uint32_t threadId = 0;
+};
+
+// owns the rings, so the zones of threads that have exited are still written
+struct TraceRegistry {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<ThreadTrace>> threads;
+};
+
+static TraceRegistry& getTraceRegistry() {
+    static TraceRegistry registry;
+    return registry;
+}
+
+static ThreadTrace& getThreadTrace() {
+    thread_local std::shared_ptr<ThreadTrace> trace = [] {
+        auto created = std::make_shared<ThreadTrace>();
+        created->threadId = GetCurrentThreadId();
+
+        TraceRegistry& registry = getTraceRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.threads.push_back(created);
+
+        return created;
+    }();
+
+    return *trace;
+}
+
+TraceZone::~TraceZone() {
+    const uint64_t end = traceNow();
+
+    ThreadTrace& trace = getThreadTrace();
+    std::lock_guard<std::mutex> lock(trace.mutex);
+
+    trace.events[trace.written % ThreadTrace::capacity] = { name, begin, end };
+    trace.written++;
+}
+
+// zone names are literals of ours, but quotes and backslashes would still break the JSON
+static void writeJsonString(std::ofstream& file, const char* text) {
+    file << '"';
+
+    for (const char* c = text; *c; c++) {
+        if (*c == '"' || *c == '\\') file << '\\';
+        file << *c;
+    }
+
+    file << '"';
+}
+
+void writeTrace(const char* path) {
+    std::ofstream file(path, std::ios::trunc);
+
+    if (!file) {
+        throw std::runtime_error("failed to open trace file");
+    }
+
+    // copied out first, so zones can still be written while the file is
+    std::vector<std::pair<uint32_t, std::vector<ZoneEvent>>> threads;
+
+    {
+        TraceRegistry& registry = getTraceRegistry();
+        std::lock_guard<std::mutex> registryLock(registry.mutex);
+
+        for (const auto& trace : registry.threads) {
+            std::lock_guard<std::mutex> lock(trace->mutex);
+
+            const uint64_t count = std::min<uint64_t>(trace->written, ThreadTrace::capacity);
+            std::vector<ZoneEvent> events(count);
+
+            // oldest first
+            for (uint64_t i = 0; i < count; i++) {
+                events[i] = trace->events[(trace->written - count + i) % ThreadTrace::capacity];
+            }
+
+            threads.emplace_back(trace->threadId, std::move(events));
+        }
+    }
+
+    const DWORD processId = GetCurrentProcessId();
+
+    file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    file << std::fixed << std::setprecision(3);
+
+    bool first = true;
+
+    for (const auto& [threadId, events] : threads) {
+        for (const ZoneEvent& event : events) {
+            file << (first ? "\n" : ",\n");
+            first = false;
+
+            // complete events, timestamps and durations in microseconds
+            file << "{\"ph\":\"X\",\"cat\":\"scatter\",\"name\":";
+            writeJsonString(file, event.name);
+            file << ",\"pid\":" << processId << ",\"tid\":" << threadId;
+            file << ",\"ts\":" << event.begin / 1000.0 << ",\"dur\":" << (event.end - event.begin) / 1000.0 << "}";
+        }
+    }
+
+    file << "\n]}\n";
+
+    if (!file) {
+        throw std::runtime_error("failed to write trace file");
+    }
+}
+
+} // scatter
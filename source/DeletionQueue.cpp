@@ -0,0 +1,27 @@
+#include "pch.h"
+#include "DeletionQueue.h"
+
+namespace scatter {
+
+void DeletionQueue::push(uint64_t frame, std::function<void()>&& deleter) {
+    // frame numbers only ever go up, so the queue stays sorted and collecting can stop at the first live entry
+    assert(entries.empty() || entries.back().frame <= frame);
+    entries.push_back({ frame, std::move(deleter) });
+}
+
+void DeletionQueue::collect(uint64_t completedFrame) {
+    while (!entries.empty() && entries.front().frame <= completedFrame) {
+        entries.front().deleter();
+        entries.pop_front();
+    }
+}
+
+void DeletionQueue::flush() {
+    for (auto& entry : entries) {
+        entry.deleter();
+    }
+
+    entries.clear();
+}
+
+}
@@ -2,6 +2,7 @@
 #include "Device.h"
 #include "Swapchain.h"
 #include "Extensions.h"
+#include "CpuTrace.h"
 
 #ifdef NDEBUG
 const bool enableValidationLayers = false;
@@ -45,6 +46,8 @@ VkCommandBuffer VulkanDevice::beginSingleTimeCommands() {
 }
 
 void VulkanDevice::endSingleTimeCommands(VkCommandBuffer buffer) {
+    SCATTER_ZONE("submit single time commands");
+
     vkEndCommandBuffer(buffer);
 
     VkSubmitInfo submitInfo = {};
@@ -52,11 +55,22 @@ void VulkanDevice::endSingleTimeCommands(VkCommandBuffer buffer) {
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &buffer;
 
-    if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    VkFence fence;
+    vkCreateFence(device, &fenceInfo, nullptr, &fence);
+
+    if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, fence) != VK_SUCCESS) {
         throw std::runtime_error("failed to submit single time queue");
     }
 
-    vkQueueWaitIdle(graphicsQueue);
+    // only wait for this submission, not for whatever else is in flight on the queue
+    {
+        SCATTER_ZONE("wait for single time commands");
+        vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+    }
+    vkDestroyFence(device, fence, nullptr);
 
     vkFreeCommandBuffers(device, commandPool, 1, &buffer);
 }
@@ -124,7 +138,10 @@ std::tuple<VkBuffer, VmaAllocation, VmaAllocationInfo> VulkanDevice::createStagi
     return { stagingBuffer, stagingAlloc, stagingAllocInfo };
 }
 
-void VulkanDevice::init() {
+void VulkanDevice::init(RayTracingExtension extension) {
+    // resolved to the extension the picked device supports
+    rayTracingExtension = extension;
+
     // standard setup
     createInstance();
     setupDebugMessenger();
@@ -142,13 +159,22 @@ void VulkanDevice::init() {
     allocInfo.instance = instance;
     allocInfo.vulkanApiVersion = VK_API_VERSION_1_2;
 
+    // the KHR extension reads build inputs and scratch memory through buffer device addresses
+    if (rayTracingExtension == RayTracingExtension::KHR) {
+        allocInfo.flags |= VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
+    }
+
     VkResult vmaResult = vmaCreateAllocator(&allocInfo, &allocator);
     if (vmaResult != VK_SUCCESS) {
         throw std::runtime_error("failed create vma allocator");
     }
 
     // init the ray tracing extension functions
-    vk_nv_ray_tracing::init(device);
+    if (rayTracingExtension == RayTracingExtension::KHR) {
+        vk_khr_acceleration_structure::init(device);
+    } else {
+        vk_nv_ray_tracing::init(device);
+    }
 }
 
 void VulkanDevice::destroy() {
@@ -165,6 +191,9 @@ void VulkanDevice::destroy() {
     vkDestroyDevice(device, nullptr);
 
     vkDestroyInstance(instance, nullptr);
+
+    // the function pointers are global, a later init on an NV device must not pick up the KHR paths
+    vk_khr_acceleration_structure::enabled = false;
 }
 
 void VulkanDevice::populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo) {
@@ -198,7 +227,7 @@ QueueFamilyIndices VulkanDevice::findQueueFamilies(VkPhysicalDevice device) {
     return indices;
 }
 
-bool VulkanDevice::checkDeviceExtensionSupport(VkPhysicalDevice device) {
+bool VulkanDevice::checkDeviceExtensionSupport(VkPhysicalDevice device, const std::vector<const char*>& extensions) {
     uint32_t extensionCount;
     vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
 
@@ -206,7 +235,7 @@ bool VulkanDevice::checkDeviceExtensionSupport(VkPhysicalDevice device) {
     vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
 
 
-    std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+    std::set<std::string> requiredExtensions(extensions.begin(), extensions.end());
     for (const auto& extension : availableExtensions) {
         requiredExtensions.erase(extension.extensionName);
     }
@@ -221,6 +250,40 @@ bool VulkanDevice::checkDeviceExtensionSupport(VkPhysicalDevice device) {
     return requiredExtensions.empty();
 }
 
+bool VulkanDevice::checkRayQuerySupport(VkPhysicalDevice device) {
+    VkPhysicalDeviceRayQueryFeaturesKHR rayQueryFeatures{};
+    rayQueryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR;
+
+    VkPhysicalDeviceAccelerationStructureFeaturesKHR accelerationStructureFeatures{};
+    accelerationStructureFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
+    accelerationStructureFeatures.pNext = &rayQueryFeatures;
+
+    VkPhysicalDeviceVulkan12Features vulkan12Features{};
+    vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    vulkan12Features.pNext = &accelerationStructureFeatures;
+
+    VkPhysicalDeviceFeatures2 features{};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &vulkan12Features;
+
+    vkGetPhysicalDeviceFeatures2(device, &features);
+
+    return vulkan12Features.bufferDeviceAddress && accelerationStructureFeatures.accelerationStructure && rayQueryFeatures.rayQuery;
+}
+
+// KHR is preferred for AUTO, it isn't tied to a single vendor
+std::optional<RayTracingExtension> VulkanDevice::findRayTracingExtension(VkPhysicalDevice device, RayTracingExtension requested) {
+    if (requested != RayTracingExtension::NV && checkDeviceExtensionSupport(device, khrRayTracingExtensions) && checkRayQuerySupport(device)) {
+        return RayTracingExtension::KHR;
+    }
+
+    if (requested != RayTracingExtension::KHR && checkDeviceExtensionSupport(device, nvRayTracingExtensions)) {
+        return RayTracingExtension::NV;
+    }
+
+    return std::nullopt;
+}
+
 void VulkanDevice::createDescriptorPool() {
     VkDescriptorPoolSize pool_sizes[] = {
         { VK_DESCRIPTOR_TYPE_SAMPLER, 1000 },
@@ -233,7 +296,8 @@ void VulkanDevice::createDescriptorPool() {
         { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1000 },
         { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1000 },
         { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1000 },
-        { VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, 1000 }
+        { VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, 1000 },
+        { rayTracingExtension == RayTracingExtension::KHR ? VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR : VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_NV, 1000 }
     };
 
     VkDescriptorPoolCreateInfo pool_info = {};
@@ -317,8 +381,11 @@ void VulkanDevice::pickPhysicalDevice() {
     VkPhysicalDeviceFeatures deviceFeatures;
 
     for (const auto& device : devices) {
-        if (isDeviceSuitable(device)) {
+        if (!isDeviceSuitable(device)) continue;
+
+        if (auto extension = findRayTracingExtension(device, rayTracingExtension)) {
             physicalDevice = device;
+            rayTracingExtension = *extension;
 
             vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
             break;
@@ -334,34 +401,59 @@ void VulkanDevice::pickPhysicalDevice() {
 void VulkanDevice::createLogicalDevice() {
     QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
 
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    // a second queue from the graphics family runs mesh uploads next to rendering,
+    // staying in the same family means buffers never need an ownership transfer
+    const uint32_t queueCount = std::min(2u, queueFamilies[indices.graphicsFamily.value()].queueCount);
+    const float queuePriorities[] = { 1.0f, 0.5f };
+
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-    std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value() };
 
     VkDeviceQueueCreateInfo queueCreateInfo{};
     queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
     queueCreateInfo.queueFamilyIndex = indices.graphicsFamily.value();
-    queueCreateInfo.queueCount = 1;
-    float queuePriority = 1.0f;
-
-    for (uint32_t queueFamily : uniqueQueueFamilies) {
-        VkDeviceQueueCreateInfo queueCreateInfo{};
-        queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-        queueCreateInfo.queueFamilyIndex = queueFamily;
-        queueCreateInfo.queueCount = 1;
-        queueCreateInfo.pQueuePriorities = &queuePriority;
-        queueCreateInfos.push_back(queueCreateInfo);
+    queueCreateInfo.queueCount = queueCount;
+    queueCreateInfo.pQueuePriorities = queuePriorities;
+    queueCreateInfos.push_back(queueCreateInfo);
+
+    // core in 1.2, used to track asynchronous mesh uploads and to reset timestamp queries without a command buffer
+    VkPhysicalDeviceVulkan12Features vulkan12Features{};
+    vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    vulkan12Features.timelineSemaphore = VK_TRUE;
+    vulkan12Features.hostQueryReset = VK_TRUE;
+
+    std::vector<const char*> extensions = deviceExtensions;
+
+    VkPhysicalDeviceRayQueryFeaturesKHR rayQueryFeatures{};
+    rayQueryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR;
+    rayQueryFeatures.rayQuery = VK_TRUE;
+
+    VkPhysicalDeviceAccelerationStructureFeaturesKHR accelerationStructureFeatures{};
+    accelerationStructureFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
+    accelerationStructureFeatures.accelerationStructure = VK_TRUE;
+    accelerationStructureFeatures.pNext = &rayQueryFeatures;
+
+    if (rayTracingExtension == RayTracingExtension::KHR) {
+        extensions.insert(extensions.end(), khrRayTracingExtensions.begin(), khrRayTracingExtensions.end());
+        vulkan12Features.bufferDeviceAddress = VK_TRUE;
+        vulkan12Features.pNext = &accelerationStructureFeatures;
+    } else {
+        extensions.insert(extensions.end(), nvRayTracingExtensions.begin(), nvRayTracingExtensions.end());
     }
 
-    queueCreateInfo.pQueuePriorities = &queuePriority;
-
     VkPhysicalDeviceFeatures deviceFeatures{};
     VkDeviceCreateInfo createInfo{};
 
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    createInfo.pNext = &vulkan12Features;
     createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
     createInfo.pQueueCreateInfos = queueCreateInfos.data();
-    createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-    createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+    createInfo.ppEnabledExtensionNames = extensions.data();
     createInfo.pEnabledFeatures = &deviceFeatures;
 
     if (enableValidationLayers) {
@@ -377,10 +469,13 @@ void VulkanDevice::createLogicalDevice() {
     }
 
     vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
+
+    // falls back to sharing the graphics queue on devices with a single queue
+    vkGetDeviceQueue(device, indices.graphicsFamily.value(), queueCount - 1, &asyncQueue);
 }
 
 bool VulkanDevice::isDeviceSuitable(VkPhysicalDevice device) {
-    bool extensionSupported = checkDeviceExtensionSupport(device);
+    bool extensionSupported = checkDeviceExtensionSupport(device, deviceExtensions);
 
     bool swapChainAdequate = true;
     //if (extensionSupported)
@@ -13,6 +13,23 @@ void vk_nv_ray_tracing::init(VkDevice device) {
     vkBindAccelerationStructureMemoryNV =               VK_LOAD_FN(device, vkBindAccelerationStructureMemoryNV);
     vkGetRayTracingShaderGroupHandlesNV =               VK_LOAD_FN(device, vkGetRayTracingShaderGroupHandlesNV);
     vkGetAccelerationStructureMemoryRequirementsNV =    VK_LOAD_FN(device, vkGetAccelerationStructureMemoryRequirementsNV);
+    vkCmdCopyAccelerationStructureNV =                  VK_LOAD_FN(device, vkCmdCopyAccelerationStructureNV);
+    vkCmdWriteAccelerationStructuresPropertiesNV =      VK_LOAD_FN(device, vkCmdWriteAccelerationStructuresPropertiesNV);
+}
+
+void vk_khr_acceleration_structure::init(VkDevice device) {
+    vkCreateAccelerationStructureKHR =                  VK_LOAD_FN(device, vkCreateAccelerationStructureKHR);
+    vkDestroyAccelerationStructureKHR =                 VK_LOAD_FN(device, vkDestroyAccelerationStructureKHR);
+    vkCmdBuildAccelerationStructuresKHR =               VK_LOAD_FN(device, vkCmdBuildAccelerationStructuresKHR);
+    vkGetAccelerationStructureBuildSizesKHR =           VK_LOAD_FN(device, vkGetAccelerationStructureBuildSizesKHR);
+    vkGetAccelerationStructureDeviceAddressKHR =        VK_LOAD_FN(device, vkGetAccelerationStructureDeviceAddressKHR);
+    vkCmdCopyAccelerationStructureKHR =                 VK_LOAD_FN(device, vkCmdCopyAccelerationStructureKHR);
+    vkCmdCopyAccelerationStructureToMemoryKHR =         VK_LOAD_FN(device, vkCmdCopyAccelerationStructureToMemoryKHR);
+    vkCmdCopyMemoryToAccelerationStructureKHR =         VK_LOAD_FN(device, vkCmdCopyMemoryToAccelerationStructureKHR);
+    vkCmdWriteAccelerationStructuresPropertiesKHR =     VK_LOAD_FN(device, vkCmdWriteAccelerationStructuresPropertiesKHR);
+    vkGetDeviceAccelerationStructureCompatibilityKHR =  VK_LOAD_FN(device, vkGetDeviceAccelerationStructureCompatibilityKHR);
+
+    enabled = true;
 }
 
 } // scatter
\ No newline at end of file
@@ -0,0 +1,158 @@
+#include "pch.h"
+#include "GpuProfiler.h"
+
+namespace scatter {
+
+void GpuProfiler::init(VulkanDevice& device, uint32_t frameCount) {
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device.physicalDevice, &familyCount, nullptr);
+
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(device.physicalDevice, &familyCount, families.data());
+
+    const uint32_t validBits = families[device.findQueueFamilies(device.physicalDevice).graphicsFamily.value()].timestampValidBits;
+
+    if (validBits == 0) return;
+
+    timestampMask = validBits >= 64 ? UINT64_MAX : (uint64_t(1) << validBits) - 1;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device.physicalDevice, &properties);
+    timestampPeriod = properties.limits.timestampPeriod;
+
+    VkQueryPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = queryCount;
+
+    frames.resize(frameCount);
+
+    for (Frame& frame : frames) {
+        if (vkCreateQueryPool(device.device, &poolInfo, nullptr, &frame.pool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create timestamp query pool");
+        }
+
+        // queries have to be reset before their first use
+        vkResetQueryPool(device.device, frame.pool, 0, queryCount);
+    }
+
+    activeFrame = 0;
+}
+
+void GpuProfiler::destroy(VkDevice device) {
+    for (Frame& frame : frames) {
+        vkDestroyQueryPool(device, frame.pool, nullptr);
+    }
+
+    frames.clear();
+}
+
+void GpuProfiler::beginFrame(VkDevice device, uint32_t frame) {
+    activeFrame = frame;
+
+    if (frames.empty()) return;
+
+    Frame& active = frames[frame];
+
+    // a value and an availability word per query, queries that weren't written are left unavailable
+    const uint32_t usedQueries = recordedQueries + 2 * static_cast<uint32_t>(active.scopes.size());
+    std::array<uint64_t, 2 * queryCount> results;
+
+    vkGetQueryPoolResults(device, active.pool, 0, usedQueries, usedQueries * 2 * sizeof(uint64_t), results.data(), 2 * sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+    const auto readScope = [&](uint32_t query, GpuPass pass) {
+        if (results[query * 2 + 1] != 0 && results[query * 2 + 3] != 0) {
+            addSample(pass, results[query * 2], results[query * 2 + 2]);
+        }
+    };
+
+    for (uint32_t pass = 0; pass < static_cast<uint32_t>(GpuPass::COUNT); pass++) {
+        readScope(pass * 2, static_cast<GpuPass>(pass));
+    }
+
+    for (uint32_t scope = 0; scope < active.scopes.size(); scope++) {
+        readScope(recordedQueries + scope * 2, active.scopes[scope]);
+    }
+
+    vkResetQueryPool(device, active.pool, 0, usedQueries);
+    active.scopes.clear();
+}
+
+uint32_t GpuProfiler::begin(VkCommandBuffer cmdBuffer, GpuPass pass) {
+    if (frames.empty()) return noScope;
+
+    Frame& active = frames[activeFrame];
+
+    if (active.scopes.size() == maxScopes) return noScope;
+
+    const uint32_t query = recordedQueries + 2 * static_cast<uint32_t>(active.scopes.size());
+    active.scopes.push_back(pass);
+
+    vkCmdWriteTimestamp(cmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, active.pool, query);
+
+    return query;
+}
+
+void GpuProfiler::end(VkCommandBuffer cmdBuffer, uint32_t scope) {
+    if (scope == noScope) return;
+
+    vkCmdWriteTimestamp(cmdBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frames[activeFrame].pool, scope + 1);
+}
+
+void GpuProfiler::beginRecorded(VkCommandBuffer cmdBuffer, uint32_t frame, GpuPass pass) {
+    if (frames.empty()) return;
+
+    vkCmdWriteTimestamp(cmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frames[frame].pool, static_cast<uint32_t>(pass) * 2);
+}
+
+void GpuProfiler::endRecorded(VkCommandBuffer cmdBuffer, uint32_t frame, GpuPass pass) {
+    if (frames.empty()) return;
+
+    vkCmdWriteTimestamp(cmdBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frames[frame].pool, static_cast<uint32_t>(pass) * 2 + 1);
+}
+
+void GpuProfiler::addSample(GpuPass pass, uint64_t begin, uint64_t end) {
+    History& history = histories[static_cast<size_t>(pass)];
+
+    // the counter may wrap around within its valid bits
+    const uint64_t ticks = (end - begin) & timestampMask;
+
+    history.samples[history.next] = static_cast<float>(double(ticks) * timestampPeriod * 1e-6);
+    history.next = (history.next + 1) % historySize;
+    history.count = std::min(history.count + 1, historySize);
+}
+
+PassTiming GpuProfiler::getTiming(GpuPass pass) const {
+    const History& history = histories[static_cast<size_t>(pass)];
+
+    std::array<float, historySize> samples = history.samples;
+
+    return summarizeSamples(samples.data(), history.count);
+}
+
+PassTiming summarizeSamples(float* samples, size_t count) {
+    PassTiming timing;
+
+    if (count == 0) return timing;
+
+    std::sort(samples, samples + count);
+
+    double sum = 0.0;
+
+    for (size_t i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+
+    // nearest rank, the smallest sample that at least 99 percent of the samples don't exceed
+    const size_t rank = (count * 99 + 99) / 100;
+
+    timing.sampleCount = static_cast<uint32_t>(count);
+    timing.min = samples[0];
+    timing.avg = static_cast<float>(sum / count);
+    timing.p99 = samples[rank - 1];
+
+    return timing;
+}
+
+} // scatter
@@ -0,0 +1,182 @@
+#include "pch.h"
+#include "InstanceMap.h"
+#include <numeric>
+
+namespace scatter {
+
+// handles pack the slot index with its generation, so stale handles to re-used slots are rejected
+static uint64_t makeHandle(uint32_t slot, uint32_t generation) {
+    return (uint64_t(generation) << 32) | slot;
+}
+
+uint64_t InstanceMap::add(const VkAccelerationStructureInstanceNV& instance) {
+    uint32_t slot;
+
+    if (freeSlots.empty()) {
+        slot = static_cast<uint32_t>(slots.size());
+        slots.emplace_back();
+    } else {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    }
+
+    const uint32_t index = size();
+    reserve(index + 1);
+
+    slots[slot].index = index;
+    instances[index] = instance;
+    instanceCount++;
+    slotIndices.push_back(slot);
+
+    markDirty(index);
+    topologyDirty = true;
+
+    return makeHandle(slot, slots[slot].generation);
+}
+
+VkAccelerationStructureInstanceNV* InstanceMap::append(size_t count, uint64_t* handles) {
+    const uint32_t first = size();
+
+    reserve(first + static_cast<uint32_t>(count));
+    instanceCount += static_cast<uint32_t>(count);
+    slotIndices.reserve(first + count);
+
+    for (size_t i = 0; i < count; i++) {
+        uint32_t slot;
+
+        if (freeSlots.empty()) {
+            slot = static_cast<uint32_t>(slots.size());
+            slots.emplace_back();
+        } else {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        }
+
+        slots[slot].index = first + static_cast<uint32_t>(i);
+        slotIndices.push_back(slot);
+
+        handles[i] = makeHandle(slot, slots[slot].generation);
+    }
+
+    if (count > 0) {
+        markDirty(first);
+        markDirty(size() - 1);
+        topologyDirty = true;
+    }
+
+    return instances + first;
+}
+
+bool InstanceMap::remove(uint64_t handle) {
+    Slot* slot = getSlot(handle);
+    if (!slot) return false;
+
+    const uint32_t index = slot->index;
+    const uint32_t last = size() - 1;
+
+    // keep the instances dense by moving the last one into the hole
+    if (index != last) {
+        reserve(size());
+
+        instances[index] = instances[last];
+        slotIndices[index] = slotIndices[last];
+        slots[slotIndices[index]].index = index;
+        markDirty(index);
+    }
+
+    instanceCount--;
+    slotIndices.pop_back();
+
+    slot->generation++;
+    freeSlots.push_back(static_cast<uint32_t>(handle & UINT32_MAX));
+
+    topologyDirty = true;
+
+    return true;
+}
+
+bool InstanceMap::setTransform(uint64_t handle, const float* transform) {
+    Slot* slot = getSlot(handle);
+    if (!slot) return false;
+
+    reserve(size());
+    std::memcpy(&instances[slot->index].transform, transform, sizeof(VkTransformMatrixKHR));
+    markDirty(slot->index);
+
+    return true;
+}
+
+void InstanceMap::clear() {
+    for (uint32_t slot : slotIndices) {
+        slots[slot].generation++;
+        freeSlots.push_back(slot);
+    }
+
+    instanceCount = 0;
+    slotIndices.clear();
+
+    topologyDirty = true;
+}
+
+const VkAccelerationStructureInstanceNV* InstanceMap::find(uint64_t handle) {
+    Slot* slot = getSlot(handle);
+    return slot ? &instances[slot->index] : nullptr;
+}
+
+void InstanceMap::sort(const std::vector<uint64_t>& keys) {
+    assert(keys.size() == size());
+
+    std::vector<uint32_t> order(size());
+    std::iota(order.begin(), order.end(), 0u);
+    std::stable_sort(order.begin(), order.end(), [&keys](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+
+    // gathered out of place, the storage is written back in one go
+    std::vector<VkAccelerationStructureInstanceNV> sortedInstances(size());
+    std::vector<uint32_t> sortedSlots(size());
+
+    for (uint32_t i = 0; i < size(); i++) {
+        sortedInstances[i] = instances[order[i]];
+        sortedSlots[i] = slotIndices[order[i]];
+        slots[sortedSlots[i]].index = i;
+    }
+
+    reserve(size());
+    std::memcpy(instances, sortedInstances.data(), size() * sizeof(VkAccelerationStructureInstanceNV));
+    slotIndices.swap(sortedSlots);
+
+    // every instance may have moved
+    if (size() > 0) {
+        markDirty(0);
+        markDirty(size() - 1);
+    }
+
+    topologyDirty = true;
+}
+
+void InstanceMap::resetChanges() {
+    dirtyBegin = UINT32_MAX;
+    dirtyEnd = 0;
+    topologyDirty = false;
+}
+
+InstanceMap::Slot* InstanceMap::getSlot(uint64_t handle) {
+    const uint32_t slot = static_cast<uint32_t>(handle & UINT32_MAX);
+    const uint32_t generation = static_cast<uint32_t>(handle >> 32);
+
+    if (slot >= slots.size() || slots[slot].generation != generation) {
+        return nullptr;
+    }
+
+    return &slots[slot];
+}
+
+void InstanceMap::reserve(uint32_t capacity) {
+    instances = storage(capacity);
+}
+
+void InstanceMap::markDirty(uint32_t index) {
+    dirtyBegin = std::min(dirtyBegin, index);
+    dirtyEnd = std::max(dirtyEnd, index + 1);
+}
+
+} // scatter
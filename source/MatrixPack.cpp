@@ -0,0 +1,60 @@
+#include "pch.h"
+#include "MatrixPack.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define SCATTER_SSE2
+#endif
+
+namespace scatter {
+
+static void packRowMajor(const float* matrices, size_t count, VkAccelerationStructureInstanceNV* instances) {
+    for (size_t i = 0; i < count; i++) {
+        const float* matrix = matrices + i * 16;
+        float* transform = &instances[i].transform.matrix[0][0];
+
+#ifdef SCATTER_SSE2
+        _mm_storeu_ps(transform, _mm_loadu_ps(matrix));
+        _mm_storeu_ps(transform + 4, _mm_loadu_ps(matrix + 4));
+        _mm_storeu_ps(transform + 8, _mm_loadu_ps(matrix + 8));
+#else
+        std::memcpy(transform, matrix, sizeof(VkTransformMatrixKHR));
+#endif
+    }
+}
+
+static void packColumnMajor(const float* matrices, size_t count, VkAccelerationStructureInstanceNV* instances) {
+    for (size_t i = 0; i < count; i++) {
+        const float* matrix = matrices + i * 16;
+        float* transform = &instances[i].transform.matrix[0][0];
+
+#ifdef SCATTER_SSE2
+        __m128 column0 = _mm_loadu_ps(matrix);
+        __m128 column1 = _mm_loadu_ps(matrix + 4);
+        __m128 column2 = _mm_loadu_ps(matrix + 8);
+        __m128 column3 = _mm_loadu_ps(matrix + 12);
+
+        // the columns turn into rows, the fourth row is dropped
+        _MM_TRANSPOSE4_PS(column0, column1, column2, column3);
+
+        _mm_storeu_ps(transform, column0);
+        _mm_storeu_ps(transform + 4, column1);
+        _mm_storeu_ps(transform + 8, column2);
+#else
+        for (int row = 0; row < 3; row++) {
+            for (int column = 0; column < 4; column++) {
+                transform[row * 4 + column] = matrix[column * 4 + row];
+            }
+        }
+#endif
+    }
+}
+
+void packTransforms(const float* matrices, size_t count, MatrixLayout layout, VkAccelerationStructureInstanceNV* instances) {
+    switch (layout) {
+        case MatrixLayout::ROW_MAJOR: packRowMajor(matrices, count, instances); break;
+        case MatrixLayout::COLUMN_MAJOR: packColumnMajor(matrices, count, instances); break;
+    }
+}
+
+}
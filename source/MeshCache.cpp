@@ -0,0 +1,129 @@
+#include "pch.h"
+#include "MeshCache.h"
+
+namespace scatter {
+
+static constexpr char magic[4] = { 'S', 'C', 'A', 'C' };
+
+template<typename T>
+static bool read(std::ifstream& file, T& value) {
+    return static_cast<bool>(file.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+template<typename T>
+static void write(std::ofstream& file, const T& value) {
+    file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void MeshCache::open(const std::filesystem::path& path, const uint8_t* deviceUUID, const uint8_t* driverUUID) {
+    close();
+
+    this->path = path;
+    std::memcpy(this->deviceUUID.data(), deviceUUID, VK_UUID_SIZE);
+    std::memcpy(this->driverUUID.data(), driverUUID, VK_UUID_SIZE);
+
+    std::ifstream file(path, std::ios::binary);
+
+    // no cache yet, it's written on save
+    if (!file.is_open()) return;
+
+    char fileMagic[4];
+    uint32_t fileVersion;
+    std::array<uint8_t, VK_UUID_SIZE> fileDeviceUUID, fileDriverUUID;
+    uint64_t entryCount;
+
+    if (!read(file, fileMagic) || !read(file, fileVersion) || !read(file, fileDeviceUUID) || !read(file, fileDriverUUID) || !read(file, entryCount)) {
+        return;
+    }
+
+    // written by another version, device or driver, start over
+    if (std::memcmp(fileMagic, magic, sizeof(magic)) != 0 || fileVersion != version || fileDeviceUUID != this->deviceUUID || fileDriverUUID != this->driverUUID) {
+        std::cout << "discarding incompatible acceleration structure cache " << path << '\n';
+        dirty = true;
+        return;
+    }
+
+    // blob sizes are checked against what's left of the file before anything is allocated
+    const std::streampos entriesBegin = file.tellg();
+    file.seekg(0, std::ios::end);
+    const uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+    file.seekg(entriesBegin);
+
+    for (uint64_t i = 0; i < entryCount; i++) {
+        uint64_t hash, size;
+
+        // a truncated file keeps everything before the damage
+        if (!read(file, hash) || !read(file, size)) break;
+
+        // a size past the end of the file means the file is corrupt, nothing in it can be trusted
+        if (size > fileSize - static_cast<uint64_t>(file.tellg())) {
+            std::cout << "discarding corrupt acceleration structure cache " << path << '\n';
+            entries.clear();
+            dirty = true;
+            return;
+        }
+
+        std::vector<uint8_t> blob(size);
+
+        if (!file.read(reinterpret_cast<char*>(blob.data()), size)) break;
+
+        entries.emplace(hash, std::move(blob));
+    }
+}
+
+void MeshCache::save() {
+    if (!isOpen() || !dirty) return;
+
+    // write next to the cache and swap, so a crash never leaves a half written file behind
+    auto tempPath = path;
+    tempPath += ".tmp";
+
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+
+        if (!file.is_open()) {
+            throw std::runtime_error("failed to write acceleration structure cache");
+        }
+
+        file.write(magic, sizeof(magic));
+        write(file, version);
+        write(file, deviceUUID);
+        write(file, driverUUID);
+        write(file, uint64_t(entries.size()));
+
+        for (auto& [hash, blob] : entries) {
+            write(file, hash);
+            write(file, uint64_t(blob.size()));
+            file.write(reinterpret_cast<const char*>(blob.data()), blob.size());
+        }
+    }
+
+    std::filesystem::rename(tempPath, path);
+    dirty = false;
+}
+
+void MeshCache::close() {
+    save();
+
+    path.clear();
+    entries.clear();
+    dirty = false;
+}
+
+const std::vector<uint8_t>* MeshCache::find(uint64_t hash) const {
+    auto it = entries.find(hash);
+    return it != entries.end() ? &it->second : nullptr;
+}
+
+void MeshCache::store(uint64_t hash, std::vector<uint8_t>&& blob) {
+    entries[hash] = std::move(blob);
+    dirty = true;
+}
+
+void MeshCache::erase(uint64_t hash) {
+    if (entries.erase(hash) > 0) {
+        dirty = true;
+    }
+}
+
+}
@@ -0,0 +1,189 @@
+#include "pch.h"
+#include "MeshPrep.h"
+#include "Hash.h"
+
+#include <cfloat>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define SCATTER_SSE2
+#endif
+
+namespace scatter {
+
+template<VertexFormat format>
+constexpr uint32_t positionComponents = format == VertexFormat::R32_SFLOAT ? 1 : format == VertexFormat::R32G32_SFLOAT ? 2 : 3;
+
+#ifdef SCATTER_SSE2
+// loads a position into the low lanes, the lanes past it are zero or, for the wider formats, ignored by the caller
+template<VertexFormat format>
+static inline __m128 loadPosition(const uint8_t* vertex) {
+    if constexpr (format == VertexFormat::R32_SFLOAT) {
+        return _mm_load_ss(reinterpret_cast<const float*>(vertex));
+    } else if constexpr (format == VertexFormat::R32G32_SFLOAT) {
+        return _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(vertex)));
+    } else {
+        return _mm_loadu_ps(reinterpret_cast<const float*>(vertex));
+    }
+}
+#endif
+
+template<VertexFormat format>
+static void extractPositions(const uint8_t* vertices, size_t stride, size_t count, float* positions) {
+    constexpr uint32_t components = positionComponents<format>;
+
+    size_t i = 0;
+
+#ifdef SCATTER_SSE2
+    // 16 bytes are loaded and stored per position, the store spills into the next position which overwrites it.
+    // That is safe for all but the last vertex, which might not have 16 readable bytes and has no successor
+    for (; i + 1 < count; i++) {
+        _mm_storeu_ps(positions + i * 3, loadPosition<format>(vertices + i * stride));
+    }
+#endif
+
+    for (; i < count; i++) {
+        float position[3] = { 0.0f, 0.0f, 0.0f };
+        std::memcpy(position, vertices + i * stride, components * sizeof(float));
+        std::memcpy(positions + i * 3, position, sizeof(position));
+    }
+}
+
+void extractPositions(VertexFormat format, const void* vertices, size_t stride, size_t count, float* positions) {
+    const auto* bytes = static_cast<const uint8_t*>(vertices);
+
+    switch (format) {
+        case VertexFormat::R32_SFLOAT: extractPositions<VertexFormat::R32_SFLOAT>(bytes, stride, count, positions); break;
+        case VertexFormat::R32G32_SFLOAT: extractPositions<VertexFormat::R32G32_SFLOAT>(bytes, stride, count, positions); break;
+        case VertexFormat::R32G32B32_SFLOAT: extractPositions<VertexFormat::R32G32B32_SFLOAT>(bytes, stride, count, positions); break;
+        case VertexFormat::R32G32B32A32_SFLOAT: extractPositions<VertexFormat::R32G32B32A32_SFLOAT>(bytes, stride, count, positions); break;
+    }
+}
+
+namespace {
+
+struct PositionKey {
+    float x, y, z;
+
+    bool operator==(const PositionKey& other) const { return x == other.x && y == other.y && z == other.z; }
+};
+
+struct PositionHasher {
+    size_t operator()(const PositionKey& key) const { return static_cast<size_t>(hashBytes(&key, sizeof(key))); }
+};
+
+}
+
+void weldPositions(const float* positions, size_t vertexCount, std::vector<uint32_t>& indices, std::vector<float>& welded) {
+    std::unordered_map<PositionKey, uint32_t, PositionHasher> unique;
+    std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+
+    welded.clear();
+
+    for (uint32_t& index : indices) {
+        if (remap[index] == UINT32_MAX) {
+            // adding zero turns -0 into 0, which compare equal but hash differently
+            const PositionKey key = { positions[index * 3] + 0.0f, positions[index * 3 + 1] + 0.0f, positions[index * 3 + 2] + 0.0f };
+
+            auto [it, inserted] = unique.emplace(key, static_cast<uint32_t>(welded.size() / 3));
+
+            if (inserted) {
+                welded.insert(welded.end(), { key.x, key.y, key.z });
+            }
+
+            remap[index] = it->second;
+        }
+
+        index = remap[index];
+    }
+}
+
+size_t removeDegenerateTriangles(const std::vector<float>& positions, uint32_t* indices, size_t indexCount) {
+    size_t kept = 0;
+
+    for (size_t i = 0; i + 2 < indexCount; i += 3) {
+        const uint32_t a = indices[i], b = indices[i + 1], c = indices[i + 2];
+
+        if (a == b || b == c || a == c) continue;
+
+        // welded positions only repeat through their index, so a zero cross product means the corners are collinear
+        const double e0[3] = { double(positions[b * 3]) - positions[a * 3], double(positions[b * 3 + 1]) - positions[a * 3 + 1], double(positions[b * 3 + 2]) - positions[a * 3 + 2] };
+        const double e1[3] = { double(positions[c * 3]) - positions[a * 3], double(positions[c * 3 + 1]) - positions[a * 3 + 1], double(positions[c * 3 + 2]) - positions[a * 3 + 2] };
+
+        const double nx = e0[1] * e1[2] - e0[2] * e1[1];
+        const double ny = e0[2] * e1[0] - e0[0] * e1[2];
+        const double nz = e0[0] * e1[1] - e0[1] * e1[0];
+
+        if (nx == 0.0 && ny == 0.0 && nz == 0.0) continue;
+
+        indices[kept++] = a;
+        indices[kept++] = b;
+        indices[kept++] = c;
+    }
+
+    return kept;
+}
+
+// rounds to the nearest half, the encoded values are within [-1, 1] so infinities and NaNs don't have to be handled
+static uint16_t toHalf(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const int32_t exponent = int32_t((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (exponent <= 0) {
+        // too small for a normal half, shift the implicit one into a subnormal
+        if (exponent < -10) return static_cast<uint16_t>(sign);
+
+        mantissa |= 0x800000;
+        const uint32_t shift = 14 - exponent;
+        const uint32_t half = (mantissa >> shift) + ((mantissa >> (shift - 1)) & 1);
+
+        return static_cast<uint16_t>(sign | half);
+    }
+
+    // a carry out of the mantissa correctly bumps the exponent
+    const uint32_t half = ((uint32_t(exponent) << 10) | (mantissa >> 13)) + ((mantissa >> 12) & 1);
+
+    return static_cast<uint16_t>(sign | half);
+}
+
+PositionDecode encodePositions(const float* positions, size_t count, bool halfFloat, uint16_t* encoded) {
+    float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+    for (size_t i = 0; i < count; i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            min[axis] = std::min(min[axis], positions[i * 3 + axis]);
+            max[axis] = std::max(max[axis], positions[i * 3 + axis]);
+        }
+    }
+
+    PositionDecode decode;
+
+    if (count == 0) return decode;
+
+    for (int axis = 0; axis < 3; axis++) {
+        decode.bias[axis] = 0.5f * (min[axis] + max[axis]);
+
+        // flat axes keep a scale of one, so the folded instance transform stays invertible
+        const float extent = 0.5f * (max[axis] - min[axis]);
+        decode.scale[axis] = extent > 0.0f ? extent : 1.0f;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            const float normalized = std::clamp((positions[i * 3 + axis] - decode.bias[axis]) / decode.scale[axis], -1.0f, 1.0f);
+
+            encoded[i * 4 + axis] = halfFloat ? toHalf(normalized) : static_cast<uint16_t>(static_cast<int16_t>(std::lround(normalized * 32767.0f)));
+        }
+
+        encoded[i * 4 + 3] = 0;
+    }
+
+    return decode;
+}
+
+}
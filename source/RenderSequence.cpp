@@ -447,7 +447,7 @@ void RayTracedShadowsSequence::destroyImages(VkDevice device) {
     shadowsTexture.destroy(device);
 }
 
-void RayTracedShadowsSequence::updateTLAS(VkDevice device, VkAccelerationStructureNV tlas) {
+void RayTracedShadowsSequence::updateTLAS(VkDevice device, VkAccelerationStructureNV tlas, uint32_t frame) {
     // AS write set
     VkWriteDescriptorSetAccelerationStructureNV write = {};
     write.accelerationStructureCount = 1;
@@ -458,29 +458,100 @@ void RayTracedShadowsSequence::updateTLAS(VkDevice device, VkAccelerationStructu
     writeAS.dstBinding = 0;
     writeAS.descriptorCount = 1;
     writeAS.pNext = &write;
-    writeAS.dstSet = descriptorSet;
+    writeAS.dstSet = descriptorSets[frame];
     writeAS.sType = VkStructureType::VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
     writeAS.descriptorType = VkDescriptorType::VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_NV;
 
     vkUpdateDescriptorSets(device, 1u, &writeAS, 0, nullptr);
 }
 
+void RayTracedShadowsSequence::updateTLAS(VkDevice device, VkAccelerationStructureKHR tlas, uint32_t frame) {
+    VkWriteDescriptorSetAccelerationStructureKHR write = {};
+    write.accelerationStructureCount = 1;
+    write.pAccelerationStructures = &tlas;
+    write.sType = VkStructureType::VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR;
+
+    VkWriteDescriptorSet writeAS = {};
+    writeAS.dstBinding = 0;
+    writeAS.descriptorCount = 1;
+    writeAS.pNext = &write;
+    writeAS.dstSet = descriptorSets[frame];
+    writeAS.sType = VkStructureType::VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writeAS.descriptorType = VkDescriptorType::VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+
+    vkUpdateDescriptorSets(device, 1u, &writeAS, 0, nullptr);
+}
+
 void RayTracedShadowsSequence::createDescriptorSets(VkDevice device, VkDescriptorPool descriptorPool) {
-    // allocate the descriptor set
+    // allocate the descriptor sets
+    const std::vector<VkDescriptorSetLayout> layouts(frameCount, descriptorSetLayout);
+    descriptorSets.resize(frameCount);
+
     VkDescriptorSetAllocateInfo descriptorAllocInfo{};
-    descriptorAllocInfo.descriptorSetCount = 1;
+    descriptorAllocInfo.descriptorSetCount = frameCount;
     descriptorAllocInfo.descriptorPool = descriptorPool;
-    descriptorAllocInfo.pSetLayouts = &descriptorSetLayout;
+    descriptorAllocInfo.pSetLayouts = layouts.data();
     descriptorAllocInfo.sType = VkStructureType::VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 
-    if (vkAllocateDescriptorSets(device, &descriptorAllocInfo, &descriptorSet)) {
+    if (vkAllocateDescriptorSets(device, &descriptorAllocInfo, descriptorSets.data())) {
         throw std::runtime_error("failed to allocate descriptor sets");
     } else {
         std::puts("Succesfully allocated descriptorSets!!");
     }
+
+    // the buffer never changes, frames pick their slot with the dynamic offset
+    VkDescriptorBufferInfo uniformBufferInfo = {};
+    uniformBufferInfo.buffer = uniformBuffer;
+    uniformBufferInfo.offset = 0;
+    uniformBufferInfo.range = sizeof(Uniforms);
+
+    for (VkDescriptorSet descriptorSet : descriptorSets) {
+        VkWriteDescriptorSet uniformWriteSet = {};
+        uniformWriteSet.dstBinding = 3;
+        uniformWriteSet.descriptorCount = 1;
+        uniformWriteSet.pBufferInfo = &uniformBufferInfo;
+        uniformWriteSet.dstSet = descriptorSet;
+        uniformWriteSet.descriptorType = VkDescriptorType::VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        uniformWriteSet.sType = VkStructureType::VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+
+        vkUpdateDescriptorSets(device, 1, &uniformWriteSet, 0, nullptr);
+    }
+}
+
+void RayTracedShadowsSequence::createUniformBuffer(VmaAllocator allocator, VkPhysicalDevice pdevice) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(pdevice, &properties);
+
+    const VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+    uniformStride = (sizeof(Uniforms) + alignment - 1) / alignment * alignment;
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VkStructureType::VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = uniformStride * frameCount;
+    bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VmaAllocationCreateInfo allocCreateInfo{};
+    allocCreateInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+    allocCreateInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    if (vmaCreateBuffer(allocator, &bufferInfo, &allocCreateInfo, &uniformBuffer, &uniformBufferAlloc, &uniformBufferAllocInfo) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate shadow uniform buffer");
+    }
+
+    for (uint32_t frame = 0; frame < frameCount; frame++) {
+        updateUniforms(allocator, frame);
+    }
 }
 
-void RayTracedShadowsSequence::updateImages(VkDevice device) {
+void RayTracedShadowsSequence::updateUniforms(VmaAllocator allocator, uint32_t frame) {
+    const VkDeviceSize offset = uniformStride * frame;
+
+    memcpy(static_cast<uint8_t*>(uniformBufferAllocInfo.pMappedData) + offset, &uniforms, sizeof(Uniforms));
+    vmaFlushAllocation(allocator, uniformBufferAlloc, offset, sizeof(Uniforms));
+}
+
+void RayTracedShadowsSequence::updateImages(VkDevice device, uint32_t frame) {
     // image write set
     VkDescriptorImageInfo shadowDescriptorImage = {};
     shadowDescriptorImage.imageView = shadowsTexture.view;
@@ -490,7 +561,7 @@ void RayTracedShadowsSequence::updateImages(VkDevice device) {
     shadowWriteSet.dstBinding = 1;
     shadowWriteSet.descriptorCount = 1;
     shadowWriteSet.pImageInfo = &shadowDescriptorImage;
-    shadowWriteSet.dstSet = descriptorSet;
+    shadowWriteSet.dstSet = descriptorSets[frame];
     shadowWriteSet.descriptorType = VkDescriptorType::VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
     shadowWriteSet.sType = VkStructureType::VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 
@@ -503,7 +574,7 @@ void RayTracedShadowsSequence::updateImages(VkDevice device) {
     depthWriteSet.dstBinding = 2;
     depthWriteSet.descriptorCount = 1;
     depthWriteSet.pImageInfo = &depthDescriptorImage;
-    depthWriteSet.dstSet = descriptorSet;
+    depthWriteSet.dstSet = descriptorSets[frame];
     depthWriteSet.descriptorType = VkDescriptorType::VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
     depthWriteSet.sType = VkStructureType::VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 
@@ -511,48 +582,34 @@ void RayTracedShadowsSequence::updateImages(VkDevice device) {
     vkUpdateDescriptorSets(device, static_cast<uint32_t>(sets.size()), sets.data(), 0, nullptr);
 }
 
-void RayTracedShadowsSequence::createPipeline(VkDevice device, VulkanShaderManager& shaderManager) {
-    //// shader stages ////
-    VkPipelineShaderStageCreateInfo raygenShaderInfo{};
-    raygenShaderInfo.pName = "main";
-    raygenShaderInfo.stage = VK_SHADER_STAGE_RAYGEN_BIT_NV;
-    raygenShaderInfo.module = shaderManager.getShader("shader/raytrace.rgen.spv");
-    raygenShaderInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-
-    VkPipelineShaderStageCreateInfo missShaderInfo{};
-    missShaderInfo.pName = "main";
-    missShaderInfo.stage = VK_SHADER_STAGE_MISS_BIT_NV;
-    missShaderInfo.module = shaderManager.getShader("shader/raytrace.rmiss.spv");
-    missShaderInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-
-    VkPipelineShaderStageCreateInfo hitShaderInfo{};
-    hitShaderInfo.pName = "main";
-    hitShaderInfo.stage = VK_SHADER_STAGE_CLOSEST_HIT_BIT_NV;
-    hitShaderInfo.module = shaderManager.getShader("shader/raytrace.rchit.spv");
-    hitShaderInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-
-    std::array<VkPipelineShaderStageCreateInfo, 3> shaderStages = { raygenShaderInfo, missShaderInfo, hitShaderInfo };
-
+// both pipelines share the bindings, only the compute pipeline has push constants for the dispatch size
+void RayTracedShadowsSequence::createLayouts(VkDevice device, VkShaderStageFlags stages, VkDescriptorType accelerationStructureType, uint32_t pushConstantSize) {
     //// descriptor set bindings ////
     VkDescriptorSetLayoutBinding TLASbinding = {};
     TLASbinding.binding = 0;
     TLASbinding.descriptorCount = 1;
-    TLASbinding.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_NV;
-    TLASbinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_NV;
+    TLASbinding.descriptorType = accelerationStructureType;
+    TLASbinding.stageFlags = stages;
 
     VkDescriptorSetLayoutBinding outputImageBinding = {};
     outputImageBinding.binding = 1;
     outputImageBinding.descriptorCount = 1;
     outputImageBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-    outputImageBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_NV;
+    outputImageBinding.stageFlags = stages;
 
     VkDescriptorSetLayoutBinding inputImageBinding = {};
     inputImageBinding.binding = 2;
     inputImageBinding.descriptorCount = 1;
     inputImageBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    inputImageBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_NV;
+    inputImageBinding.stageFlags = stages;
 
-    std::array<VkDescriptorSetLayoutBinding, 3> bindings = { TLASbinding, outputImageBinding,  inputImageBinding };
+    VkDescriptorSetLayoutBinding uniformBinding = {};
+    uniformBinding.binding = 3;
+    uniformBinding.descriptorCount = 1;
+    uniformBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    uniformBinding.stageFlags = stages;
+
+    std::array<VkDescriptorSetLayoutBinding, 4> bindings = { TLASbinding, outputImageBinding,  inputImageBinding, uniformBinding };
 
     VkDescriptorSetLayoutCreateInfo descriptorSetLayoutInfo{};
     descriptorSetLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -568,14 +625,14 @@ void RayTracedShadowsSequence::createPipeline(VkDevice device, VulkanShaderManag
     //// create the pipeline layout ////
     VkPushConstantRange pcr{};
     pcr.offset = 0;
-    pcr.size = sizeof(pushData);
-    pcr.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_NV;
+    pcr.size = pushConstantSize;
+    pcr.stageFlags = stages;
 
     VkPipelineLayoutCreateInfo layoutCreateInfo = {};
     layoutCreateInfo.sType = VkStructureType::VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     layoutCreateInfo.setLayoutCount = 1;
     layoutCreateInfo.pSetLayouts = &descriptorSetLayout;
-    layoutCreateInfo.pushConstantRangeCount = 1;
+    layoutCreateInfo.pushConstantRangeCount = pushConstantSize > 0 ? 1 : 0;
     layoutCreateInfo.pPushConstantRanges = &pcr;
 
     if (vkCreatePipelineLayout(device, &layoutCreateInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
@@ -583,6 +640,31 @@ void RayTracedShadowsSequence::createPipeline(VkDevice device, VulkanShaderManag
     } else {
         std::cout << "successfully created pipeline layout! \n";
     }
+}
+
+void RayTracedShadowsSequence::createPipeline(VkDevice device, VulkanShaderManager& shaderManager) {
+    //// shader stages ////
+    VkPipelineShaderStageCreateInfo raygenShaderInfo{};
+    raygenShaderInfo.pName = "main";
+    raygenShaderInfo.stage = VK_SHADER_STAGE_RAYGEN_BIT_NV;
+    raygenShaderInfo.module = shaderManager.getShader("shader/raytrace.rgen.spv");
+    raygenShaderInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+
+    VkPipelineShaderStageCreateInfo missShaderInfo{};
+    missShaderInfo.pName = "main";
+    missShaderInfo.stage = VK_SHADER_STAGE_MISS_BIT_NV;
+    missShaderInfo.module = shaderManager.getShader("shader/raytrace.rmiss.spv");
+    missShaderInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+
+    VkPipelineShaderStageCreateInfo hitShaderInfo{};
+    hitShaderInfo.pName = "main";
+    hitShaderInfo.stage = VK_SHADER_STAGE_CLOSEST_HIT_BIT_NV;
+    hitShaderInfo.module = shaderManager.getShader("shader/raytrace.rchit.spv");
+    hitShaderInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+
+    std::array<VkPipelineShaderStageCreateInfo, 3> shaderStages = { raygenShaderInfo, missShaderInfo, hitShaderInfo };
+
+    createLayouts(device, VK_SHADER_STAGE_RAYGEN_BIT_NV, VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_NV, 0);
 
     /// define the groups, a miss group and raygen group
     VkRayTracingShaderGroupCreateInfoNV group = {};
@@ -622,6 +704,27 @@ void RayTracedShadowsSequence::createPipeline(VkDevice device, VulkanShaderManag
     }
 }
 
+void RayTracedShadowsSequence::createComputePipeline(VkDevice device, VulkanShaderManager& shaderManager) {
+    createLayouts(device, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, sizeof(VkExtent2D));
+
+    VkPipelineShaderStageCreateInfo computeShaderInfo{};
+    computeShaderInfo.pName = "main";
+    computeShaderInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    computeShaderInfo.module = shaderManager.getShader("shader/shadows.comp.spv");
+    computeShaderInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage = computeShaderInfo;
+    pipelineInfo.layout = pipelineLayout;
+
+    if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create ray query pipeline");
+    } else {
+        std::puts("sucessfuly created ray query pipeline!!");
+    }
+}
+
 void RayTracedShadowsSequence::createSbtTable(VkDevice device, VmaAllocator allocator, const VkPhysicalDeviceRayTracingPropertiesNV& rtProps) {
     const uint32_t groupCount = static_cast<uint32_t>(groups.size());
     const uint32_t sbtSize = groupCount * rtProps.shaderGroupBaseAlignment;
@@ -660,7 +763,18 @@ void RayTracedShadowsSequence::createSbtTable(VkDevice device, VmaAllocator allo
     }
 }
 
-void RayTracedShadowsSequence::init(VkDevice device, VmaAllocator allocator, VkPhysicalDevice pdevice, VulkanShaderManager& shaderManager) {
+void RayTracedShadowsSequence::init(VkDevice device, VmaAllocator allocator, VkPhysicalDevice pdevice, VulkanShaderManager& shaderManager, bool rayQuery, uint32_t frameCount) {
+    this->rayQuery = rayQuery;
+    this->frameCount = frameCount;
+
+    createUniformBuffer(allocator, pdevice);
+
+    // ray queries trace from a compute shader, there's no shader binding table
+    if (rayQuery) {
+        createComputePipeline(device, shaderManager);
+        return;
+    }
+
     createPipeline(device, shaderManager);
 
     // get physical device memory and rtx properties
@@ -684,15 +798,25 @@ void RayTracedShadowsSequence::destroy(VkDevice device, VmaAllocator allocator,
     vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
     vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
     
-    vkFreeDescriptorSets(device, descriptorPool, 1, &descriptorSet);
+    vkFreeDescriptorSets(device, descriptorPool, static_cast<uint32_t>(descriptorSets.size()), descriptorSets.data());
 
     depthTexture.destroy(device);
     shadowsTexture.destroy(device);
 
-    vmaDestroyBuffer(allocator, sbtBuffer, sbtAlloc);
+    vmaDestroyBuffer(allocator, uniformBuffer, uniformBufferAlloc);
+
+    if (!rayQuery) {
+        vmaDestroyBuffer(allocator, sbtBuffer, sbtAlloc);
+    }
 }
 
-void RayTracedShadowsSequence::execute(VkDevice device, VkCommandBuffer cmdBuffer, uint32_t width, uint32_t height, const VkPhysicalDeviceRayTracingPropertiesNV& rtProps) {
+void RayTracedShadowsSequence::execute(VkDevice device, VkCommandBuffer cmdBuffer, uint32_t width, uint32_t height, const VkPhysicalDeviceRayTracingPropertiesNV& rtProps, uint32_t frame) {
+    const uint32_t uniformOffset = static_cast<uint32_t>(uniformStride * frame);
+
+    // acceleration structure builds are submitted to the same queue without waiting, make their results visible to the trace
+    GlobalMemoryBarrier(cmdBuffer, VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_NV, VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_NV,
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV, rayQuery ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV);
+
     // acquire textures for ray tracing use
     ImageMemoryBarrier(cmdBuffer, depthTexture.image, VK_IMAGE_ASPECT_DEPTH_BIT,
         0, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
@@ -700,10 +824,21 @@ void RayTracedShadowsSequence::execute(VkDevice device, VkCommandBuffer cmdBuffe
     ImageMemoryBarrier(cmdBuffer, shadowsTexture.image, VK_IMAGE_ASPECT_COLOR_BIT,
         0, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
 
+    if (rayQuery) {
+        const VkExtent2D extent = { width, height };
+
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSets[frame], 1, &uniformOffset);
+        vkCmdPushConstants(cmdBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(extent), &extent);
+
+        // one invocation per pixel in 8x8 groups, the shader discards the invocations past the edges
+        vkCmdDispatch(cmdBuffer, (width + 7) / 8, (height + 7) / 8, 1);
+        return;
+    }
+
     // bind the pipeline and resources
     vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_NV, pipeline);
-    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_NV, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
-    vkCmdPushConstants(cmdBuffer, pipelineLayout, VK_SHADER_STAGE_RAYGEN_BIT_NV, 0, sizeof(pushData), &pushData);
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_NV, pipelineLayout, 0, 1, &descriptorSets[frame], 1, &uniformOffset);
 
     VkDeviceSize rayGenOffset = 0;  // Start at the beginning of m_sbtBuffer
     VkDeviceSize missOffset = 1u * rtProps.shaderGroupBaseAlignment;  // Jump over raygen
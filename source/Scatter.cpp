@@ -2,400 +2,2862 @@
 #include "Scatter.h"
 #include "RenderSequence.h"
 #include "AccelStructure.h"
+#include "InstanceMap.h"
+#include "DeletionQueue.h"
+#include "Hash.h"
+#include "UploadBuffer.h"
+#include "MeshCache.h"
+#include "Util.h"
+#include "Simplify.h"
+#include "MeshPrep.h"
+#include "MatrixPack.h"
+#include "GpuProfiler.h"
+#include "CpuTrace.h"
 #include <queue>
+#include <map>
+#include <unordered_set>
+#include <cfloat>
 
 namespace scatter {
 
+struct Mesh {
+    BottomLevelAS blas;
+    VkDeviceSize buildSize = 0;
+
+    // value of the mesh timeline that signals the build is done, 0 for meshes built synchronously
+    uint64_t readyValue = 0;
+
+    // hash of the geometry if the structure is shared with identical meshes, see Scatter::Impl::deduplicate
+    uint64_t contentHash = 0;
+
+    // the structure is built from a simplified proxy if these differ
+    uint32_t sourceTriangleCount = 0;
+    uint32_t triangleCount = 0;
+};
+
+// what a content hash hit is checked against, so a collision doesn't hand out the structure of other geometry
+struct MeshIdentity {
+    uint32_t vertexCount = 0;
+    uint32_t indexCount = 0;
+    VertexFormat vertexFormat = VertexFormat::R32G32B32_SFLOAT;
+    IndexFormat indexFormat = IndexFormat::UINT32;
+
+    // the same key hashed with another seed
+    uint64_t verifyHash = 0;
+
+    bool operator==(const MeshIdentity& other) const {
+        return vertexCount == other.vertexCount && indexCount == other.indexCount && vertexFormat == other.vertexFormat &&
+            indexFormat == other.indexFormat && verifyHash == other.verifyHash;
+    }
+};
+
+struct SharedMesh {
+    Mesh mesh;
+    MeshIdentity identity;
+    uint32_t refCount = 0;
+};
+
+struct MeshUpload {
+    VkBuffer stagingBuffer;
+    VmaAllocation stagingAlloc;
+    VulkanBuffer geometryBuffer;
+    std::vector<BottomLevelAS> blases;
+    std::vector<VkGeometryNV> geometries;
+
+    // meshes built with ALLOW_COMPACTION, in the order of their compacted size queries
+    std::vector<uint32_t> compactable;
+};
+
+// deformable meshes keep their geometry resident, so new vertices can be copied in and the structure refitted
+struct DeformableMesh {
+    VulkanBuffer geometryBuffer;
+    std::vector<VkGeometryNV> geometries;
+    VkDeviceSize vertexSize = 0;
+};
+
+// object space bounds of a bottom level acceleration structure
+struct Bounds {
+    glm::vec3 min = glm::vec3(0.0f);
+    glm::vec3 max = glm::vec3(0.0f);
+};
+
+// geometry as it is uploaded, only the welded positions and the triangles that have an area, see Scatter::Impl::prepareMeshes
+struct PreparedMesh {
+    std::vector<float> positions;
+    std::vector<uint8_t> indices;
+    std::vector<SubmeshDescription> submeshes;
+
+    // the positions in 16 bits per component if input compression is enabled, decoded by the instance transform
+    std::vector<uint16_t> encoded;
+    PositionDecode decode;
+    bool compressed = false;
+
+    // bounds of the uploaded positions, encoded or not
+    Bounds bounds;
+};
+
+// geometry of a batchable mesh, kept on the GPU so its static instances can be merged, see Scatter::Impl::bakeStatic
+struct RetainedGeometry {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    std::vector<VkGeometryNV> geometries;
+};
+
+// every mesh of an upload shares its geometry buffer, it is released with the last batchable mesh in it
+struct RetainedBuffer {
+    VulkanBuffer buffer;
+    uint32_t refCount = 0;
+};
+
+// what a recorded shadow command buffer depends on, see Scatter::Impl::submit
+struct ShadowRecording {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint64_t version = 0;
+};
+
+// everything a frame in flight writes to, reused once the GPU has finished the frame that used it last
+struct FrameSlot {
+    // refits of deformable meshes, recorded every frame that has any
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+
+    // the trace, recorded once and submitted as is while the recording matches
+    VkCommandBuffer shadowCommandBuffer = VK_NULL_HANDLE;
+    ShadowRecording recording;
+
+    VkFence fence = VK_NULL_HANDLE;
+    UploadBuffer vertexStaging;
+
+    // the submitted frame that used the slot last, 0 if none did
+    uint64_t frame = 0;
+};
+
+// a grid cell of merged static instances, drawn as a single instance
+struct StaticBatch {
+    BottomLevelAS blas;
+    uint64_t instance = 0;
+};
+
 class SCATTER_API Scatter::Impl {
 public:
     void setLightDirection(float x, float y, float z) {
-        rtx.pushData.lightDirection = glm::vec4(x, y, z, 1.0);
+        rtx.uniforms.lightDirection = glm::vec4(x, y, z, 1.0);
+    }
+
+    void setInverseViewProjectionMatrix(float* matrix) {
+        memcpy(glm::value_ptr(rtx.uniforms.inverseViewProjection), matrix, sizeof(glm::mat4));
+    }
+
+    void init(RayTracingBackend backend) {
+        device.init(getRayTracingExtension(backend));
+        shaderManager.init(device.device);
+        rtx.init(device.device, device.allocator, device.physicalDevice, shaderManager, device.getRayTracingExtension() == RayTracingExtension::KHR, framesInFlight);
+        rtx.createDescriptorSets(device.device, device.descriptorPool);
+        selectCompressedFormat();
+
+        createInteropSemaphores();
+
+        // slots start out free, their fences signaled
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+        frames.resize(framesInFlight);
+
+        for (FrameSlot& slot : frames) {
+            vkCreateFence(device.device, &fenceInfo, nullptr, &slot.fence);
+            slot.commandBuffer = device.createCommandBuffer();
+            slot.shadowCommandBuffer = device.createCommandBuffer();
+        }
+
+        TLAS.setSlotCount(framesInFlight);
+        instances.setStorage([this](uint32_t capacity) { return TLAS.acquireInstances(device, capacity); });
+
+        // submit refits from the instances of the last build, which only the frame fences cover
+        TLAS.setFrameCallbacks([this](uint64_t frame) { waitForFrame(frame); }, [this](VkBuffer buffer, VmaAllocation alloc) {
+            deletionQueue.push(submittedFrame + 1, [this, buffer, alloc]() {
+                vmaDestroyBuffer(device.allocator, buffer, alloc);
+            });
+        });
+
+        gpuProfiler.init(device, framesInFlight);
+        TLAS.setProfiler(&gpuProfiler);
+
+        // the ray query path has no shader binding table to lay out
+        if (device.getRayTracingExtension() == RayTracingExtension::NV) {
+            rtProps.sType = VkStructureType::VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PROPERTIES_NV;
+
+            VkPhysicalDeviceProperties2 pdProps{};
+            pdProps.sType = VkStructureType::VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+            pdProps.pNext = &rtProps;
+
+            vkGetPhysicalDeviceProperties2(device.physicalDevice, &pdProps);
+        }
+
+        VkSemaphoreTypeCreateInfo timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        timelineInfo.initialValue = 0;
+
+        VkSemaphoreCreateInfo timelineSemaphoreInfo{};
+        timelineSemaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        timelineSemaphoreInfo.pNext = &timelineInfo;
+
+        if (vkCreateSemaphore(device.device, &timelineSemaphoreInfo, nullptr, &meshSemaphore) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create mesh timeline semaphore");
+        }
+
+        meshScratchArena.setQueue(device.asyncQueue);
+    }
+
+    // vertex input API
+
+    void setVertexStride(uint32_t stride) { attribDesc.vertexStride = stride; }
+
+    void setVertexOffset(uint32_t offset) { attribDesc.vertexOffset = offset; }
+
+    void setVertexFormat(VertexFormat format) { attribDesc.vertexFormat = format; }
+
+    void setIndexFormat(IndexFormat format) { attribDesc.indexFormat = format; }
+
+    HANDLE getShadowTextureMemoryHandle() {
+        return rtx.getShadowTextureMemoryHandle(device.device);
+    }
+
+    size_t getShadowTextureMemorySize() {
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(device.device, rtx.shadowsTexture.image, &memRequirements);
+        return memRequirements.size;
+    }
+
+    size_t getDepthTextureMemorySize() {
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(device.device, rtx.depthTexture.image, &memRequirements);
+        return memRequirements.size;
+    }
+
+    // the ready and done semaphores are exported to the host, binary or, in timeline mode, timeline semaphores
+    void createInteropSemaphores() {
+        VkExportSemaphoreCreateInfo exportInfo = {};
+        exportInfo.sType = VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO;
+        exportInfo.handleTypes = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_WIN32_BIT;
+
+        VkSemaphoreTypeCreateInfo typeInfo{};
+        typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        typeInfo.pNext = &exportInfo;
+        typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        typeInfo.initialValue = 0;
+
+        VkSemaphoreCreateInfo semaphoreInfo = {};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        semaphoreInfo.pNext = timelineSemaphores ? static_cast<const void*>(&typeInfo) : &exportInfo;
+
+        if (timelineSemaphores) {
+            // not every driver that has timeline semaphores can export them. The query only takes the semaphore type,
+            // so it gets a type info of its own instead of the one that chains the export info
+            VkSemaphoreTypeCreateInfo queryTypeInfo{};
+            queryTypeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+            queryTypeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+            queryTypeInfo.initialValue = 0;
+
+            VkPhysicalDeviceExternalSemaphoreInfo externalInfo{};
+            externalInfo.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_SEMAPHORE_INFO;
+            externalInfo.pNext = &queryTypeInfo;
+            externalInfo.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_WIN32_BIT;
+
+            VkExternalSemaphoreProperties externalProps{};
+            externalProps.sType = VK_STRUCTURE_TYPE_EXTERNAL_SEMAPHORE_PROPERTIES;
+
+            vkGetPhysicalDeviceExternalSemaphoreProperties(device.physicalDevice, &externalInfo, &externalProps);
+
+            if (!(externalProps.externalSemaphoreFeatures & VK_EXTERNAL_SEMAPHORE_FEATURE_EXPORTABLE_BIT)) {
+                throw std::runtime_error("timeline semaphores can't be exported on this device");
+            }
+        }
+
+        if (vkCreateSemaphore(device.device, &semaphoreInfo, nullptr, &doneSemaphore) != VK_SUCCESS ||
+            vkCreateSemaphore(device.device, &semaphoreInfo, nullptr, &readySemaphore) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create interop semaphores");
+        }
+    }
+
+    void setTimelineSemaphores(bool enabled) {
+        if (!frames.empty()) {
+            throw std::runtime_error("the semaphore type has to be set before init");
+        }
+
+        timelineSemaphores = enabled;
+    }
+
+    HANDLE getReadySemaphoreHandle() {
+        auto vkGetSemaphoreWin32HandleKHR = PFN_vkGetSemaphoreWin32HandleKHR(vkGetDeviceProcAddr(device.device, "vkGetSemaphoreWin32HandleKHR"));
+
+        HANDLE handle;
+
+        VkSemaphoreGetWin32HandleInfoKHR info = {};
+        info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_WIN32_HANDLE_INFO_KHR;
+        info.semaphore = readySemaphore;
+        info.handleType = VkExternalSemaphoreHandleTypeFlagBits::VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_WIN32_BIT;
+
+        if (vkGetSemaphoreWin32HandleKHR(device.device, &info, &handle) != VK_SUCCESS) {
+            throw std::runtime_error("failed to export semaphore");
+        }
+
+        return handle;
     }
 
-    void setInverseViewProjectionMatrix(float* matrix) {
-        memcpy(glm::value_ptr(rtx.pushData.inverseViewProjection), matrix, sizeof(glm::mat4));
+    HANDLE getDoneSemaphoreHandle() {
+        auto vkGetSemaphoreWin32HandleKHR = PFN_vkGetSemaphoreWin32HandleKHR(vkGetDeviceProcAddr(device.device, "vkGetSemaphoreWin32HandleKHR"));
+
+        HANDLE handle;
+
+        VkSemaphoreGetWin32HandleInfoKHR info = {};
+        info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_WIN32_HANDLE_INFO_KHR;
+        info.semaphore = doneSemaphore;
+        info.handleType = VkExternalSemaphoreHandleTypeFlagBits::VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_WIN32_BIT;
+
+        if (vkGetSemaphoreWin32HandleKHR(device.device, &info, &handle) != VK_SUCCESS) {
+            throw std::runtime_error("failed to export semaphore");
+        }
+
+        return handle;
+    }
+
+    RayTracingBackend getBackend() {
+        return device.getRayTracingExtension() == RayTracingExtension::KHR ? RayTracingBackend::KHR_RAY_QUERY : RayTracingBackend::NV_RAY_TRACING;
+    }
+
+    void submit(uint32_t width, uint32_t height) {
+        if (timelineSemaphores) {
+            throw std::runtime_error("timeline semaphores need a wait value to submit");
+        }
+
+        submitFrame(width, height, 0);
+    }
+
+    uint64_t submit(uint32_t width, uint32_t height, uint64_t waitValue) {
+        if (!timelineSemaphores) {
+            throw std::runtime_error("wait values need timeline semaphores, see setTimelineSemaphores");
+        }
+
+        return submitFrame(width, height, waitValue);
+    }
+
+    // returns the number of the submitted frame, which the done semaphore is set to in timeline mode
+    uint64_t submitFrame(uint32_t width, uint32_t height, uint64_t waitValue) {
+        const uint32_t frame = activeFrame;
+        FrameSlot& slot = frames[frame];
+
+        // the slot was acquired at the end of the previous submit, the GPU is done with it
+        rtx.updateUniforms(device.allocator, frame);
+
+        // the trace only has to be recorded again if it would record something different
+        ShadowRecording& recording = slot.recording;
+
+        if (recording.width != width || recording.height != height || recording.version != shadowVersion) {
+            VkCommandBufferBeginInfo beginInfo = {};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+            SCATTER_ZONE("record shadows");
+
+            // the slot's fence was waited when it was acquired, nothing pending uses its descriptor set anymore
+            rtx.updateImages(device.device, frame);
+
+            if (TLAS.isBuilt()) {
+                if (vk_khr_acceleration_structure::enabled) {
+                    rtx.updateTLAS(device.device, TLAS.asKHR, frame);
+                } else {
+                    rtx.updateTLAS(device.device, TLAS.as, frame);
+                }
+            }
+
+            vkBeginCommandBuffer(slot.shadowCommandBuffer, &beginInfo);
+            gpuProfiler.beginRecorded(slot.shadowCommandBuffer, frame, GpuPass::SHADOW_TRACE);
+            rtx.execute(device.device, slot.shadowCommandBuffer, width, height, rtProps, frame);
+            gpuProfiler.endRecorded(slot.shadowCommandBuffer, frame, GpuPass::SHADOW_TRACE);
+            vkEndCommandBuffer(slot.shadowCommandBuffer);
+
+            recording.width = width;
+            recording.height = height;
+            recording.version = shadowVersion;
+        }
+
+        // refits of deformable meshes go in front of the trace
+        std::array<VkCommandBuffer, 2> submitBuffers = { slot.commandBuffer, slot.shadowCommandBuffer };
+        const bool updateVertices = !vertexUpdates.empty();
+
+        if (updateVertices) {
+            VkCommandBufferBeginInfo beginInfo = {};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+            vkBeginCommandBuffer(slot.commandBuffer, &beginInfo);
+            recordVertexUpdates(slot.commandBuffer, slot.vertexStaging);
+            vkEndCommandBuffer(slot.commandBuffer);
+        }
+
+        vkResetFences(device.device, 1, &slot.fence);
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+
+        VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_ALL_COMMANDS_BIT };
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = &readySemaphore;
+        submitInfo.pWaitDstStageMask = waitStages;
+
+        submitInfo.commandBufferCount = updateVertices ? 2 : 1;
+        submitInfo.pCommandBuffers = updateVertices ? submitBuffers.data() : &slot.shadowCommandBuffer;
+
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &doneSemaphore;
+
+        // the done value is the frame number, so it only ever increases
+        const uint64_t signalValue = submittedFrame + 1;
+
+        VkTimelineSemaphoreSubmitInfo timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.waitSemaphoreValueCount = 1;
+        timelineInfo.pWaitSemaphoreValues = &waitValue;
+        timelineInfo.signalSemaphoreValueCount = 1;
+        timelineInfo.pSignalSemaphoreValues = &signalValue;
+
+        if (timelineSemaphores) {
+            submitInfo.pNext = &timelineInfo;
+        }
+
+        {
+            SCATTER_ZONE("submit frame");
+
+            if (vkQueueSubmit(device.graphicsQueue, 1, &submitInfo, slot.fence) != VK_SUCCESS) {
+                throw std::runtime_error("failed to submit draw command buffer! \n");
+            }
+        }
+
+        submittedFrame = signalValue;
+        slot.frame = submittedFrame;
+
+        // vertex updates and the uniforms of the next frame are written to the next slot right away,
+        // so it's acquired now. This only blocks if the CPU is a full ring of frames ahead of the GPU
+        activeFrame = (activeFrame + 1) % framesInFlight;
+        acquireFrame(activeFrame);
+
+        return signalValue;
+    }
+
+    // waits for the GPU to finish the last frame that used the slot, anything that frame or an earlier one used can be released
+    void acquireFrame(uint32_t frame) {
+        FrameSlot& slot = frames[frame];
+
+        {
+            SCATTER_ZONE("wait for frame");
+            vkWaitForFences(device.device, 1, &slot.fence, VK_TRUE, UINT64_MAX);
+        }
+
+        completedFrame = std::max(completedFrame, slot.frame);
+        deletionQueue.collect(completedFrame);
+
+        slot.vertexStaging.reset();
+
+        // the timestamps the slot wrote are done as well
+        gpuProfiler.beginFrame(device.device, frame);
+    }
+
+    // frames finish in order, so the fence of the frame's slot covers it even if the slot was used again since
+    void waitForFrame(uint64_t frame) {
+        if (frame <= completedFrame) return;
+
+        FrameSlot& slot = frames[(frame - 1) % framesInFlight];
+
+        {
+            SCATTER_ZONE("wait for frame");
+            vkWaitForFences(device.device, 1, &slot.fence, VK_TRUE, UINT64_MAX);
+        }
+
+        completedFrame = std::max(completedFrame, slot.frame);
+    }
+
+    void setFramesInFlight(uint32_t count) {
+        if (!frames.empty()) {
+            throw std::runtime_error("frames in flight have to be set before init");
+        }
+
+        if (count == 0) {
+            throw std::runtime_error("at least one frame has to be in flight");
+        }
+
+        framesInFlight = count;
+    }
+
+    uint64_t getCompletedFrame() {
+        if (timelineSemaphores) {
+            uint64_t value = 0;
+            vkGetSemaphoreCounterValue(device.device, doneSemaphore, &value);
+            completedFrame = std::max(completedFrame, value);
+
+            return completedFrame;
+        }
+
+        // frames finish in order, so the newest finished slot covers every frame before it
+        for (const FrameSlot& slot : frames) {
+            if (slot.frame > completedFrame && vkGetFenceStatus(device.device, slot.fence) == VK_SUCCESS) {
+                completedFrame = slot.frame;
+            }
+        }
+
+        return completedFrame;
+    }
+
+    uint32_t getFrameLatency() {
+        return static_cast<uint32_t>(submittedFrame - getCompletedFrame());
+    }
+
+    void createTextures(uint32_t width, uint32_t height) {
+        VkPhysicalDeviceMemoryProperties memoryProperties;
+        vkGetPhysicalDeviceMemoryProperties(device.physicalDevice, &memoryProperties);
+        rtx.createImages(device.device, { width, height }, &memoryProperties);
+
+        // the descriptor sets are written when their frames record the trace again
+        shadowVersion++;
+    }
+
+    void destroyTextures() {
+        rtx.destroyImages(device.device);
+    }
+
+    uint64_t addMesh(void* vertices, void* indices, unsigned int vertexCount, unsigned int indexCount) {
+        MeshDescription mesh;
+        mesh.vertices = vertices;
+        mesh.indices = indices;
+        mesh.vertexCount = vertexCount;
+        mesh.indexCount = indexCount;
+
+        uint64_t handle = 0;
+        addMeshes(&mesh, 1, &handle);
+
+        return handle;
+    }
+
+    void addMeshes(const MeshDescription* meshes, size_t count, uint64_t* handles) {
+        if (count == 0) return;
+
+        assert(meshes && handles);
+
+        validateMeshes(meshes, count);
+
+        // only the prepared positions are uploaded from here on, simplified for meshes that ask for a shadow proxy
+        const MeshDescription* sources = meshes;
+        std::vector<MeshDescription> descriptions;
+        std::vector<PreparedMesh> prepared;
+        meshes = prepareMeshes(meshes, count, descriptions, prepared);
+
+        if (deduplicateMeshes) {
+            deduplicate(meshes, prepared.data(), count, handles, false);
+        } else {
+            buildMeshes(meshes, count, handles);
+        }
+
+        storePreparedMeshes(prepared, handles);
+        storeTriangleCounts(sources, meshes, count, handles);
+    }
+
+    void buildMeshes(const MeshDescription* meshes, size_t count, uint64_t* handles) {
+        // only the KHR extension can serialize structures
+        if (!meshCache.isOpen() || !vk_khr_acceleration_structure::enabled) {
+            buildUncachedMeshes(meshes, count, handles);
+            return;
+        }
+
+        std::vector<uint64_t> hashes(count);
+        std::vector<const std::vector<uint8_t>*> blobs;
+        std::vector<size_t> cached, uncached;
+        std::vector<MeshDescription> uncachedMeshes;
+
+        for (size_t i = 0; i < count; i++) {
+            hashes[i] = hashMesh(meshes[i], false);
+
+            // batchable meshes need their geometry on the GPU, so they are always built
+            if (const std::vector<uint8_t>* blob = meshes[i].batchable ? nullptr : findCachedMesh(hashes[i])) {
+                blobs.push_back(blob);
+                cached.push_back(i);
+            } else {
+                uncachedMeshes.push_back(meshes[i]);
+                uncached.push_back(i);
+            }
+        }
+
+        if (!cached.empty()) {
+            std::vector<uint64_t> cachedHandles(cached.size());
+            restoreMeshes(blobs, cachedHandles.data());
+
+            for (size_t i = 0; i < cached.size(); i++) {
+                handles[cached[i]] = cachedHandles[i];
+            }
+        }
+
+        if (!uncached.empty()) {
+            std::vector<uint64_t> uncachedHandles(uncached.size());
+            std::vector<uint64_t> uncachedHashes(uncached.size());
+
+            buildUncachedMeshes(uncachedMeshes.data(), uncachedMeshes.size(), uncachedHandles.data());
+
+            for (size_t i = 0; i < uncached.size(); i++) {
+                handles[uncached[i]] = uncachedHandles[i];
+                uncachedHashes[i] = hashes[uncached[i]];
+            }
+
+            storeMeshes(uncachedHandles, uncachedHashes);
+        }
+    }
+
+    void buildUncachedMeshes(const MeshDescription* meshes, size_t count, uint64_t* handles) {
+        std::vector<VkBuildAccelerationStructureFlagsNV> buildFlags(count);
+        uint32_t compactableCount = 0;
+
+        for (size_t i = 0; i < count; i++) {
+            buildFlags[i] = getBuildFlags(meshes[i], true);
+
+            if (buildFlags[i] & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_NV) {
+                compactableCount++;
+            }
+        }
+
+        VkQueryPool queryPool = VK_NULL_HANDLE;
+
+        if (compactableCount > 0) {
+            VkQueryPoolCreateInfo queryPoolInfo{};
+            queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            queryPoolInfo.queryType = BottomLevelAS::getCompactedSizeQueryType();
+            queryPoolInfo.queryCount = compactableCount;
+
+            if (vkCreateQueryPool(device.device, &queryPoolInfo, nullptr, &queryPool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create compacted size query pool");
+            }
+        }
+
+        auto cmdBuffer = device.beginSingleTimeCommands();
+
+        const std::vector<BufferDescription> layouts = getPreparedLayouts(meshes, count);
+        MeshUpload upload = recordMeshes(cmdBuffer, layouts.data(), meshes, count, scratchArena, queryPool, buildFlags.data(), true);
+
+        device.endSingleTimeCommands(cmdBuffer);
+
+        vmaDestroyBuffer(device.allocator, upload.stagingBuffer, upload.stagingAlloc);
+
+        std::vector<VkDeviceSize> buildSizes(count);
+
+        for (size_t i = 0; i < count; i++) {
+            buildSizes[i] = upload.blases[i].allocInfo.size;
+        }
+
+        if (queryPool != VK_NULL_HANDLE) {
+            compact(upload.blases, upload.compactable, queryPool);
+            vkDestroyQueryPool(device.device, queryPool, nullptr);
+        }
+
+        // retained geometry is keyed by the final structure, so this has to follow compaction
+        if (!retainGeometry(meshes, count, upload)) {
+            upload.geometryBuffer.destroy(device);
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            Mesh mesh;
+            mesh.blas = upload.blases[i];
+            mesh.buildSize = buildSizes[i];
+
+            handles[i] = nextMeshHandle++;
+            bottomLevels.emplace(handles[i], mesh);
+        }
+    }
+
+    uint64_t addMesh(void* vertices, void* indices, unsigned int vertexCount, unsigned int indexCount, const SubmeshDescription* submeshes, unsigned int submeshCount) {
+        assert(submeshes || submeshCount == 0);
+
+        MeshDescription mesh;
+        mesh.vertices = vertices;
+        mesh.indices = indices;
+        mesh.vertexCount = vertexCount;
+        mesh.indexCount = indexCount;
+        mesh.submeshes = submeshes;
+        mesh.submeshCount = submeshCount;
+
+        uint64_t handle = 0;
+        addMeshes(&mesh, 1, &handle);
+
+        return handle;
+    }
+
+    uint64_t addMeshAsync(void* vertices, void* indices, unsigned int vertexCount, unsigned int indexCount) {
+        MeshDescription mesh;
+        mesh.vertices = vertices;
+        mesh.indices = indices;
+        mesh.vertexCount = vertexCount;
+        mesh.indexCount = indexCount;
+
+        uint64_t handle = 0;
+        addMeshesAsync(&mesh, 1, &handle);
+
+        return handle;
+    }
+
+    void addMeshesAsync(const MeshDescription* meshes, size_t count, uint64_t* handles) {
+        if (count == 0) return;
+
+        assert(meshes && handles);
+
+        validateMeshes(meshes, count);
+
+        // the geometry is copied to the staging buffer before returning, so the prepared meshes don't have to outlive the build
+        const MeshDescription* sources = meshes;
+        std::vector<MeshDescription> descriptions;
+        std::vector<PreparedMesh> prepared;
+        meshes = prepareMeshes(meshes, count, descriptions, prepared);
+
+        if (deduplicateMeshes) {
+            deduplicate(meshes, prepared.data(), count, handles, true);
+        } else {
+            buildMeshesAsync(meshes, count, handles);
+        }
+
+        storePreparedMeshes(prepared, handles);
+        storeTriangleCounts(sources, meshes, count, handles);
+    }
+
+    void buildMeshesAsync(const MeshDescription* meshes, size_t count, uint64_t* handles) {
+        VkCommandBuffer cmdBuffer = device.createCommandBuffer();
+
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        vkBeginCommandBuffer(cmdBuffer, &beginInfo);
+
+        // compaction needs the compacted sizes read back first, so asynchronous meshes are never compacted
+        std::vector<VkBuildAccelerationStructureFlagsNV> buildFlags(count);
+
+        for (size_t i = 0; i < count; i++) {
+            buildFlags[i] = getBuildFlags(meshes[i], false);
+        }
+
+        const std::vector<BufferDescription> layouts = getPreparedLayouts(meshes, count);
+        // timestamps are only read back for the graphics queue
+        MeshUpload upload = recordMeshes(cmdBuffer, layouts.data(), meshes, count, meshScratchArena, VK_NULL_HANDLE, buildFlags.data(), false);
+
+        vkEndCommandBuffer(cmdBuffer);
+
+        const uint64_t value = ++meshSubmitValue;
+
+        VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.signalSemaphoreValueCount = 1;
+        timelineInfo.pSignalSemaphoreValues = &value;
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &cmdBuffer;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &meshSemaphore;
+
+        {
+            SCATTER_ZONE("submit mesh upload");
+
+            if (vkQueueSubmit(device.asyncQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+                throw std::runtime_error("failed to submit mesh upload");
+            }
+        }
+
+        const bool retained = retainGeometry(meshes, count, upload);
+
+        // the upload resources are released once the timeline passes this value
+        meshUploads.push(value, [this, cmdBuffer, retained, stagingBuffer = upload.stagingBuffer, stagingAlloc = upload.stagingAlloc, geometryBuffer = upload.geometryBuffer]() mutable {
+            vmaDestroyBuffer(device.allocator, stagingBuffer, stagingAlloc);
+
+            if (!retained) {
+                geometryBuffer.destroy(device);
+            }
+
+            vkFreeCommandBuffers(device.device, device.commandPool, 1, &cmdBuffer);
+        });
+
+        for (size_t i = 0; i < count; i++) {
+            Mesh mesh;
+            mesh.blas = upload.blases[i];
+            mesh.buildSize = upload.blases[i].allocInfo.size;
+            mesh.readyValue = value;
+
+            handles[i] = nextMeshHandle++;
+            bottomLevels.emplace(handles[i], mesh);
+            pendingMeshes.emplace(mesh.blas.handle, value);
+        }
+    }
+
+    bool isMeshReady(uint64_t handle) {
+        return getMesh(handle).readyValue <= updateMeshes();
+    }
+
+    void waitMeshes() {
+        VkSemaphoreWaitInfo waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &meshSemaphore;
+        waitInfo.pValues = &meshSubmitValue;
+
+        {
+            SCATTER_ZONE("wait for meshes");
+            vkWaitSemaphores(device.device, &waitInfo, UINT64_MAX);
+        }
+
+        updateMeshes();
+    }
+
+    void setMeshCompaction(bool enabled) {
+        compactMeshes = enabled;
+    }
+
+    void setBuildPreference(BuildPreference preference) {
+        if (static_cast<unsigned int>(preference) & static_cast<unsigned int>(BuildPreference::SCENE_DEFAULT)) {
+            throw std::runtime_error("the scene default can't refer to itself");
+        }
+
+        buildPreference = preference;
+    }
+
+    void setMeshCache(const char* path) {
+        if (path == nullptr) {
+            meshCache.close();
+            return;
+        }
+
+        // the NV extension can't serialize structures, reading the file would only load blobs nothing can use
+        if (!vk_khr_acceleration_structure::enabled) return;
+
+        // blobs are only valid for the exact device and driver that wrote them
+        VkPhysicalDeviceIDProperties idProperties{};
+        idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+
+        VkPhysicalDeviceProperties2 properties{};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties.pNext = &idProperties;
+
+        vkGetPhysicalDeviceProperties2(device.physicalDevice, &properties);
+
+        meshCache.open(path, idProperties.deviceUUID, idProperties.driverUUID);
+    }
+
+    void setMeshDeduplication(bool enabled) {
+        deduplicateMeshes = enabled;
+    }
+
+    void setInputCompression(bool enabled) {
+        inputCompression = enabled;
+    }
+
+    MeshMemoryStats getMeshMemoryStats(uint64_t handle) {
+        const Mesh& mesh = getMesh(handle);
+
+        MeshMemoryStats stats;
+        stats.buildSize = mesh.buildSize;
+        stats.size = mesh.blas.allocInfo.size;
+        stats.sourceTriangleCount = mesh.sourceTriangleCount;
+        stats.triangleCount = mesh.triangleCount;
+        return stats;
+    }
+
+    uint64_t addInstance(uint64_t handle, float* transform) {
+        assert(transform);
+
+        return instances.add(createInstance(getMesh(handle).blas.handle, transform));
+    }
+
+    void addInstances(const float* matrices, const uint64_t* meshes, size_t count, MatrixLayout layout, uint64_t* handles) {
+        if (count == 0) return;
+
+        assert(matrices && meshes && handles);
+
+        // resolve every mesh first, so an invalid handle throws before anything is added.
+        // Instances of the same mesh tend to be submitted together, which saves most lookups
+        std::vector<uint64_t> references(count);
+
+        for (size_t i = 0; i < count; i++) {
+            references[i] = i > 0 && meshes[i] == meshes[i - 1] ? references[i - 1] : getMesh(meshes[i]).blas.handle;
+        }
+
+        // the appended instances live in the mapped instance buffer of the next build, nothing is copied after this
+        VkAccelerationStructureInstanceNV* added = instances.append(count, handles);
+        packTransforms(matrices, count, layout, added);
+
+        for (size_t i = 0; i < count; i++) {
+            initInstance(references[i], added[i]);
+        }
+    }
+
+    void setInstanceTransform(uint64_t instance, float* transform) {
+        assert(transform);
+
+        const VkAccelerationStructureInstanceNV* data = instances.find(instance);
+
+        if (data == nullptr) {
+            throw std::runtime_error("invalid instance handle");
+        }
+
+        VkTransformMatrixKHR decoded;
+        std::memcpy(&decoded, transform, sizeof(VkTransformMatrixKHR));
+        applyPositionDecode(data->accelerationStructureReference, decoded);
+
+        instances.setTransform(instance, &decoded.matrix[0][0]);
+    }
+
+    void removeInstance(uint64_t instance) {
+        if (!instances.remove(instance)) {
+            throw std::runtime_error("invalid instance handle");
+        }
+
+        staticInstances.erase(instance);
+    }
+
+    void markStatic(uint64_t instance) {
+        const VkAccelerationStructureInstanceNV* data = instances.find(instance);
+
+        if (data == nullptr) {
+            throw std::runtime_error("invalid instance handle");
+        }
+
+        if (retainedGeometry.find(data->accelerationStructureReference) == retainedGeometry.end()) {
+            throw std::runtime_error("static instances need a batchable mesh");
+        }
+
+        staticInstances.insert(instance);
+    }
+
+    StaticBatchStats bakeStatic(float cellSize) {
+        if (!(cellSize > 0.0f)) {
+            throw std::runtime_error("cell size has to be positive");
+        }
+
+        StaticBatchStats stats;
+        stats.instanceCountBefore = instances.size();
+
+        // the geometry of meshes still uploading on the async queue has to be complete
+        waitMeshes();
+
+        // group by the cell that contains the translation, the map keeps the batches in a stable order
+        std::map<std::array<int32_t, 3>, std::vector<uint64_t>> cells;
+
+        for (uint64_t handle : staticInstances) {
+            const VkAccelerationStructureInstanceNV* instance = instances.find(handle);
+
+            // the mesh was destroyed since, the instance is left as it is
+            if (instance == nullptr || retainedGeometry.find(instance->accelerationStructureReference) == retainedGeometry.end()) continue;
+
+            const std::array<int32_t, 3> cell = {
+                static_cast<int32_t>(std::floor(instance->transform.matrix[0][3] / cellSize)),
+                static_cast<int32_t>(std::floor(instance->transform.matrix[1][3] / cellSize)),
+                static_cast<int32_t>(std::floor(instance->transform.matrix[2][3] / cellSize))
+            };
+
+            cells[cell].push_back(handle);
+        }
+
+        staticInstances.clear();
+
+        // split crowded cells, so a single build doesn't get arbitrarily large
+        std::vector<std::vector<uint64_t>> batches;
+        uint32_t bakedCount = 0;
+
+        for (auto& [cell, handles] : cells) {
+            // a lone instance gains nothing from merging
+            if (handles.size() < 2) continue;
+
+            batches.emplace_back();
+            uint32_t geometryCount = 0;
+
+            for (uint64_t handle : handles) {
+                const uint32_t count = static_cast<uint32_t>(retainedGeometry.at(instances.find(handle)->accelerationStructureReference).geometries.size());
+
+                if (geometryCount + count > maxBatchGeometries && !batches.back().empty()) {
+                    batches.emplace_back();
+                    geometryCount = 0;
+                }
+
+                batches.back().push_back(handle);
+                geometryCount += count;
+            }
+
+            bakedCount += static_cast<uint32_t>(handles.size());
+        }
+
+        if (batches.empty()) {
+            stats.instanceCountAfter = instances.size();
+            return stats;
+        }
+
+        const uint32_t batchCount = static_cast<uint32_t>(batches.size());
+
+        // every merged instance reads its transform from this buffer
+        const VkDeviceSize transformSize = VkDeviceSize(bakedCount) * sizeof(VkTransformMatrixKHR);
+
+        auto [stagingBuffer, stagingAlloc, stagingAllocInfo] = device.createStagingBuffer(transformSize);
+        auto* transforms = static_cast<VkTransformMatrixKHR*>(stagingAllocInfo.pMappedData);
+
+        VulkanBuffer transformBuffer;
+        transformBuffer.create(device, transformSize, GetBuildInputUsage());
+
+        std::vector<VkGeometryNV> geometries;
+        std::vector<size_t> firstGeometry(batchCount);
+        std::vector<Bounds> batchBounds(batchCount);
+        uint32_t transformIndex = 0;
+
+        for (uint32_t i = 0; i < batchCount; i++) {
+            firstGeometry[i] = geometries.size();
+
+            for (uint64_t handle : batches[i]) {
+                const VkAccelerationStructureInstanceNV* instance = instances.find(handle);
+                transforms[transformIndex] = instance->transform;
+
+                const Bounds bounds = transformBounds(getBounds(instance->accelerationStructureReference), instance->transform);
+                batchBounds[i].min = handle == batches[i].front() ? bounds.min : glm::min(batchBounds[i].min, bounds.min);
+                batchBounds[i].max = handle == batches[i].front() ? bounds.max : glm::max(batchBounds[i].max, bounds.max);
+
+                for (VkGeometryNV geometry : retainedGeometry.at(instance->accelerationStructureReference).geometries) {
+                    geometry.geometry.triangles.transformData = transformBuffer.getBuffer();
+                    geometry.geometry.triangles.transformOffset = VkDeviceSize(transformIndex) * sizeof(VkTransformMatrixKHR);
+                    geometries.push_back(geometry);
+                }
+
+                transformIndex++;
+            }
+        }
+
+        std::vector<VkAccelerationStructureCreateInfoNV> createInfos(batchCount);
+        std::vector<BottomLevelAS> blases(batchCount);
+        std::vector<VkDeviceSize> scratchSizes(batchCount);
+        VkDeviceSize scratchSize = 0;
+
+        for (uint32_t i = 0; i < batchCount; i++) {
+            const size_t endGeometry = i + 1 < batchCount ? firstGeometry[i + 1] : geometries.size();
+
+            VkAccelerationStructureCreateInfoNV& createInfo = createInfos[i];
+            createInfo.sType = VkStructureType::VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_NV;
+            createInfo.info.sType = VkStructureType::VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_INFO_NV;
+            createInfo.info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_NV;
+            createInfo.info.flags = staticBatchBuildFlags;
+            createInfo.info.geometryCount = static_cast<uint32_t>(endGeometry - firstGeometry[i]);
+            createInfo.info.pGeometries = &geometries[firstGeometry[i]];
+
+            blases[i].init(device.device, device.allocator, &createInfo);
+            scratchSizes[i] = blases[i].getScratchSize(device.device);
+            scratchSize = std::max(scratchSize, scratchSizes[i]);
+        }
+
+        scratchArena.reserve(device, scratchSize);
+        scratchArena.reset();
+
+        VkQueryPoolCreateInfo queryPoolInfo{};
+        queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolInfo.queryType = BottomLevelAS::getCompactedSizeQueryType();
+        queryPoolInfo.queryCount = batchCount;
+
+        VkQueryPool queryPool;
+
+        if (vkCreateQueryPool(device.device, &queryPoolInfo, nullptr, &queryPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create compacted size query pool");
+        }
+
+        auto cmdBuffer = device.beginSingleTimeCommands();
+
+        vkCmdResetQueryPool(cmdBuffer, queryPool, 0, batchCount);
+
+        VkBufferCopy copyRegion{};
+        copyRegion.size = transformSize;
+        vkCmdCopyBuffer(cmdBuffer, stagingBuffer, transformBuffer.getBuffer(), 1, &copyRegion);
+
+        GlobalMemoryBarrier(cmdBuffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_NV,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV);
+
+        // an earlier build on the same queue might still be using the scratch arena
+        AccelerationStructureBarrier(cmdBuffer);
+
+        const uint32_t scope = gpuProfiler.begin(cmdBuffer, GpuPass::BLAS_BUILD);
+
+        for (uint32_t i = 0; i < batchCount; i++) {
+            ScratchAllocation scratch;
+
+            if (!scratchArena.allocate(scratchSizes[i], scratch)) {
+                AccelerationStructureBarrier(cmdBuffer);
+                scratchArena.reset();
+                scratchArena.allocate(scratchSizes[i], scratch);
+            }
+
+            blases[i].build(device.device, cmdBuffer, &createInfos[i], scratch.buffer, scratch.offset);
+        }
+
+        gpuProfiler.end(cmdBuffer, scope);
+
+        std::vector<const BottomLevelAS*> structures(batchCount);
+        std::vector<uint32_t> compactable(batchCount);
+
+        for (uint32_t i = 0; i < batchCount; i++) {
+            structures[i] = &blases[i];
+            compactable[i] = i;
+        }
+
+        AccelerationStructureBarrier(cmdBuffer);
+
+        BottomLevelAS::writeProperties(cmdBuffer, structures, BottomLevelAS::getCompactedSizeQueryType(), queryPool);
+
+        device.endSingleTimeCommands(cmdBuffer);
+
+        vmaDestroyBuffer(device.allocator, stagingBuffer, stagingAlloc);
+        transformBuffer.destroy(device);
+
+        compact(blases, compactable, queryPool);
+        vkDestroyQueryPool(device.device, queryPool, nullptr);
+
+        // the merged structures replace the instances they were baked from
+        for (const std::vector<uint64_t>& batch : batches) {
+            for (uint64_t handle : batch) {
+                instances.remove(handle);
+            }
+        }
+
+        // the instance transforms are baked into the geometry
+        const float identity[12] = { 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f };
+
+        for (uint32_t i = 0; i < batchCount; i++) {
+            StaticBatch batch;
+            batch.blas = blases[i];
+            batch.instance = instances.add(createInstance(blases[i].handle, identity));
+            staticBatches.push_back(batch);
+
+            localBounds[blases[i].handle] = batchBounds[i];
+        }
+
+        stats.instanceCountAfter = instances.size();
+        stats.bakedInstanceCount = bakedCount;
+        stats.batchCount = batchCount;
+
+        return stats;
+    }
+
+    void build(bool waitForMeshes) {
+        const uint64_t completedValue = updateMeshes();
+
+        // instances of meshes that are still being built on the async queue are left out until they are ready
+        const bool skipPending = !waitForMeshes && !pendingMeshes.empty();
+
+        // nothing changed since the last build, the current structure is still valid
+        if (TLAS.isBuilt() && !instances.hasChanges() && !skippedInstances) return;
+
+        // the order only matters to a full build, so refits keep theirs
+        if (sortInstances && instances.isTopologyDirty()) {
+            sortByMortonCode();
+        }
+
+        const VkAccelerationStructureInstanceNV* instanceData = instances.data();
+        uint32_t instanceCount = instances.size();
+
+        if (skipPending) {
+            readyInstances.clear();
+
+            for (uint32_t i = 0; i < instanceCount; i++) {
+                if (pendingMeshes.find(instanceData[i].accelerationStructureReference) == pendingMeshes.end()) {
+                    readyInstances.push_back(instanceData[i]);
+                }
+            }
+
+            instanceData = readyInstances.data();
+            instanceCount = static_cast<uint32_t>(readyInstances.size());
+        }
+
+        // the topology flag of the instance map says nothing about a filtered list, so that is compared instead
+        const bool filtered = skipPending || skippedInstances;
+
+        const bool sameTopology = TLAS.isBuilt() && ((!filtered && !instances.isTopologyDirty()) || hasSameTopology(instanceData, instanceCount));
+
+        TLAS.invalidate(instances.getDirtyBegin(), instances.getDirtyEnd());
+
+        instances.resetChanges();
+        skippedInstances = skipPending;
+
+        // bottom levels built on the async queue are made visible to the build on the GPU, this never blocks the host
+        const uint64_t waitValue = skipPending ? completedValue : meshSubmitValue;
+        const VkSemaphore waitSemaphore = waitValue > 0 ? meshSemaphore : VK_NULL_HANDLE;
+
+        // without any instances, or while all of them are pending, the structure is built empty so every ray misses.
+        // Keeping the last structure would shadow with instances that were removed
+        VkAccelerationStructureCreateInfoNV TLAScreateInfo = getTopLevelCreateInfo(instanceCount);
+
+        // refit as long as only the transforms changed, rebuild every so often as refitting degrades the tree
+        const bool refit = sameTopology && TLASrefitCount < TLASrefitLimit;
+
+        if (refit) {
+            TLAS.record(device, &TLAScreateInfo, scratchArena, skipPending ? instanceData : nullptr, true, waitSemaphore, waitValue);
+            TLASrefitCount++;
+            return;
+        }
+
+        if (TLAS.isBuilt()) {
+            deferDestroy(TLAS);
+        }
+
+        TLAS.init(device.device, device.allocator, &TLAScreateInfo);
+        TLAS.record(device, &TLAScreateInfo, scratchArena, skipPending ? instanceData : nullptr, false, waitSemaphore, waitValue);
+
+        // the traces are recorded again with the new structure bound, see submitFrame
+        shadowVersion++;
+
+        TLASrefitCount = 0;
+        TLASreferences.resize(instanceCount);
+
+        for (uint32_t i = 0; i < instanceCount; i++) {
+            TLASreferences[i] = instanceData[i].accelerationStructureReference;
+        }
+    }
+
+    uint64_t addDeformableMesh(void* vertices, void* indices, unsigned int vertexCount, unsigned int indexCount) {
+        MeshDescription mesh;
+        mesh.vertices = vertices;
+        mesh.indices = indices;
+        mesh.vertexCount = vertexCount;
+        mesh.indexCount = indexCount;
+
+        auto cmdBuffer = device.beginSingleTimeCommands();
+
+        // deformable meshes are uploaded as they are, so new vertices can be copied straight over them
+        MeshUpload upload = recordMeshes(cmdBuffer, &attribDesc, &mesh, 1, scratchArena, VK_NULL_HANDLE, &deformableBuildFlags, true);
+
+        device.endSingleTimeCommands(cmdBuffer);
+
+        vmaDestroyBuffer(device.allocator, upload.stagingBuffer, upload.stagingAlloc);
+
+        DeformableMesh deformable;
+        deformable.geometryBuffer = upload.geometryBuffer;
+        deformable.geometries = std::move(upload.geometries);
+        deformable.vertexSize = VkDeviceSize(attribDesc.vertexStride) * vertexCount;
+
+        Mesh result;
+        result.blas = upload.blases[0];
+        result.buildSize = upload.blases[0].allocInfo.size;
+        result.sourceTriangleCount = indexCount / 3;
+        result.triangleCount = indexCount / 3;
+
+        const uint64_t handle = nextMeshHandle++;
+        bottomLevels.emplace(handle, result);
+        deformableMeshes.emplace(handle, std::move(deformable));
+
+        // the bounds of the initial vertices, only used to order instances
+        storeBounds(attribDesc, &mesh, 1, &handle);
+
+        return handle;
+    }
+
+    void updateMeshVertices(uint64_t handle, void* vertices) {
+        assert(vertices);
+
+        auto it = deformableMeshes.find(handle);
+
+        if (it == deformableMeshes.end()) {
+            throw std::runtime_error("mesh is not deformable");
+        }
+
+        UploadBuffer& staging = frames[activeFrame].vertexStaging;
+
+        // only the last update before a submit is used, so a repeated update reuses the staging of the earlier one
+        auto update = vertexUpdates.find(handle);
+
+        if (update != vertexUpdates.end()) {
+            staging.write(update->second, vertices, it->second.vertexSize);
+        } else {
+            vertexUpdates.emplace(handle, staging.push(device, vertices, it->second.vertexSize));
+        }
+    }
+
+    void setTopLevelRefitLimit(uint32_t limit) {
+        TLASrefitLimit = limit;
+    }
+
+    void setInstanceSorting(bool enabled) {
+        sortInstances = enabled;
+    }
+
+    void destroyMesh(uint64_t handle) {
+        auto it = bottomLevels.find(handle);
+
+        if (it != bottomLevels.end()) {
+            // shared structures are only released with their last handle
+            if (it->second.contentHash != 0) {
+                auto shared = sharedMeshes.find(it->second.contentHash);
+
+                if (--shared->second.refCount > 0) {
+                    bottomLevels.erase(it);
+                    return;
+                }
+
+                sharedMeshes.erase(shared);
+            }
+
+            if (it->second.readyValue > updateMeshes()) {
+                // still being built on the async queue, hand it to the frame queue once the build is done.
+                // Uploads queued after this one have later values, releasing it with them keeps the queue sorted
+                meshUploads.push(std::max(it->second.readyValue, meshUploads.lastFrame()), [this, blas = it->second.blas]() mutable {
+                    releaseGeometry(blas.handle);
+                    localBounds.erase(blas.handle);
+                    positionDecodes.erase(blas.handle);
+                    deferDestroy(blas);
+                });
+            } else {
+                releaseGeometry(it->second.blas.handle);
+                localBounds.erase(it->second.blas.handle);
+                positionDecodes.erase(it->second.blas.handle);
+                deferDestroy(it->second.blas);
+            }
+
+            auto deformable = deformableMeshes.find(handle);
+
+            if (deformable != deformableMeshes.end()) {
+                deletionQueue.push(submittedFrame + 1, [this, geometryBuffer = deformable->second.geometryBuffer]() mutable {
+                    geometryBuffer.destroy(device);
+                });
+
+                deformableMeshes.erase(deformable);
+                vertexUpdates.erase(handle);
+            }
+
+            bottomLevels.erase(it);
+        }
+    }
+
+    void clearInstances() {
+        instances.clear();
+        staticInstances.clear();
+
+        for (StaticBatch& batch : staticBatches) {
+            localBounds.erase(batch.blas.handle);
+            deferDestroy(batch.blas);
+        }
+
+        staticBatches.clear();
+    }
+
+    void trimScratch() {
+        scratchArena.trim(device);
+    }
+
+    GpuTimings getGpuTimings() {
+        GpuTimings timings;
+        timings.shadowTrace = gpuProfiler.getTiming(GpuPass::SHADOW_TRACE);
+        timings.blasBuild = gpuProfiler.getTiming(GpuPass::BLAS_BUILD);
+        timings.tlasBuild = gpuProfiler.getTiming(GpuPass::TLAS_BUILD);
+        return timings;
+    }
+
+    ScratchStats getScratchStats() {
+        ScratchStats stats;
+        stats.capacity = scratchArena.getCapacity();
+        stats.highWaterMark = scratchArena.getHighWaterMark();
+        stats.allocationCount = scratchArena.getAllocationCount();
+        stats.growCount = scratchArena.getGrowCount();
+        return stats;
+    }
+
+    HANDLE getDepthTextureMemoryhandle() {
+        return rtx.getDepthTextureMemoryHandle(device.device);
+    }
+
+    void destroy() {
+        meshCache.close();
+
+        waitMeshes();
+        meshUploads.flush();
+
+        for (FrameSlot& slot : frames) {
+            vkWaitForFences(device.device, 1, &slot.fence, VK_TRUE, UINT64_MAX);
+        }
+
+        TLAS.wait(device.device);
+        deletionQueue.flush();
+
+        shaderManager.destroy();
+        for (auto& [handle, mesh] : bottomLevels) {
+            if (mesh.contentHash == 0) {
+                mesh.blas.destroy(device.device, device.allocator);
+            }
+        }
+
+        for (auto& [hash, shared] : sharedMeshes) {
+            shared.mesh.blas.destroy(device.device, device.allocator);
+        }
+
+        for (auto& [handle, deformable] : deformableMeshes) {
+            deformable.geometryBuffer.destroy(device);
+        }
+
+        for (auto& [buffer, retained] : retainedBuffers) {
+            retained.buffer.destroy(device);
+        }
+
+        for (StaticBatch& batch : staticBatches) {
+            batch.blas.destroy(device.device, device.allocator);
+        }
+
+        for (FrameSlot& slot : frames) {
+            slot.vertexStaging.destroy(device);
+        }
+
+        TLAS.destroyInstances(device);
+        TLAS.destroy(device.device, device.allocator);
+
+        scratchArena.trim(device);
+        meshScratchArena.trim(device);
+
+        rtx.destroy(device.device, device.allocator, device.descriptorPool);
+        gpuProfiler.destroy(device.device);
+
+        for (FrameSlot& slot : frames) {
+            vkFreeCommandBuffers(device.device, device.commandPool, 1, &slot.commandBuffer);
+            vkFreeCommandBuffers(device.device, device.commandPool, 1, &slot.shadowCommandBuffer);
+            vkDestroyFence(device.device, slot.fence, nullptr);
+        }
+
+        frames.clear();
+
+        vkDestroySemaphore(device.device, readySemaphore, nullptr);
+        vkDestroySemaphore(device.device, doneSemaphore, nullptr);
+        vkDestroySemaphore(device.device, meshSemaphore, nullptr);
+
+        device.destroy();
+    }
+
+
+private:
+    static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+
+    static RayTracingExtension getRayTracingExtension(RayTracingBackend backend) {
+        switch (backend) {
+            case RayTracingBackend::NV_RAY_TRACING: return RayTracingExtension::NV;
+            case RayTracingBackend::KHR_RAY_QUERY: return RayTracingExtension::KHR;
+            case RayTracingBackend::AUTO: return RayTracingExtension::AUTO;
+        }
+
+        return RayTracingExtension::AUTO;
+    }
+
+    static uint32_t getPositionSize(VertexFormat format) {
+        switch (format) {
+            case VertexFormat::R32_SFLOAT: return sizeof(float);
+            case VertexFormat::R32G32_SFLOAT: return sizeof(float) * 2;
+            case VertexFormat::R32G32B32_SFLOAT: return sizeof(float) * 3;
+            case VertexFormat::R32G32B32A32_SFLOAT: return sizeof(float) * 4;
+        }
+
+        return sizeof(float) * 3;
+    }
+
+    static uint32_t getIndexSize(IndexFormat format) {
+        switch (format) {
+            case IndexFormat::UINT16: return sizeof(uint16_t);
+            case IndexFormat::UINT32: return sizeof(uint32_t);
+        }
+
+        return sizeof(uint32_t);
+    }
+
+    VkGeometryNV createGeometry(const BufferDescription& layout, VkBuffer buffer, VkDeviceSize vertexOffset, uint32_t vertexCount, VkDeviceSize indexOffset, uint32_t indexCount, bool opaque) {
+        VkGeometryNV geometry{};
+        geometry.sType = VK_STRUCTURE_TYPE_GEOMETRY_NV;
+        geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_NV;
+        geometry.flags = opaque ? VK_GEOMETRY_OPAQUE_BIT_NV : 0;
+
+        geometry.geometry.aabbs = {};
+        geometry.geometry.aabbs.sType = { VK_STRUCTURE_TYPE_GEOMETRY_AABB_NV };
+
+        geometry.geometry.triangles.sType = VK_STRUCTURE_TYPE_GEOMETRY_TRIANGLES_NV;
+        geometry.geometry.triangles.vertexData = buffer;
+        geometry.geometry.triangles.vertexOffset = vertexOffset + layout.vertexOffset;
+        geometry.geometry.triangles.vertexCount = vertexCount;
+        geometry.geometry.triangles.vertexStride = layout.vertexStride;
+        geometry.geometry.triangles.vertexFormat = static_cast<VkFormat>(layout.vertexFormat);
+        geometry.geometry.triangles.indexData = buffer;
+        geometry.geometry.triangles.indexOffset = indexOffset;
+        geometry.geometry.triangles.indexCount = indexCount;
+        geometry.geometry.triangles.indexType = static_cast<VkIndexType>(layout.indexFormat);
+        geometry.geometry.triangles.transformData = VK_NULL_HANDLE;
+        geometry.geometry.triangles.transformOffset = 0;
+
+        return geometry;
+    }
+
+    // object space bounds of the positions of every mesh, so instances can be placed without reading back the structures
+    void storeBounds(const BufferDescription& layout, const MeshDescription* meshes, size_t count, const uint64_t* handles) {
+        const uint32_t components = std::min(getPositionSize(layout.vertexFormat) / uint32_t(sizeof(float)), 3u);
+
+        for (size_t i = 0; i < count; i++) {
+            const auto* vertices = static_cast<const uint8_t*>(meshes[i].vertices) + layout.vertexOffset;
+
+            Bounds bounds;
+
+            for (size_t j = 0; j < meshes[i].vertexCount; j++) {
+                glm::vec3 position(0.0f);
+                std::memcpy(&position, vertices + j * layout.vertexStride, components * sizeof(float));
+
+                bounds.min = j == 0 ? position : glm::min(bounds.min, position);
+                bounds.max = j == 0 ? position : glm::max(bounds.max, position);
+            }
+
+            localBounds[getMesh(handles[i]).blas.handle] = bounds;
+        }
+    }
+
+    Bounds getBounds(uint64_t reference) {
+        auto it = localBounds.find(reference);
+        return it != localBounds.end() ? it->second : Bounds();
+    }
+
+    // bounds of the transformed box, the center is transformed and the extent grows by the absolute rotation and scale
+    static Bounds transformBounds(const Bounds& bounds, const VkTransformMatrixKHR& transform) {
+        const glm::vec3 center = (bounds.min + bounds.max) * 0.5f;
+        const glm::vec3 extent = (bounds.max - bounds.min) * 0.5f;
+
+        Bounds result;
+
+        for (int row = 0; row < 3; row++) {
+            const glm::vec3 axis(transform.matrix[row][0], transform.matrix[row][1], transform.matrix[row][2]);
+            const float worldCenter = glm::dot(axis, center) + transform.matrix[row][3];
+            const float worldExtent = glm::dot(glm::abs(axis), extent);
+
+            result.min[row] = worldCenter - worldExtent;
+            result.max[row] = worldCenter + worldExtent;
+        }
+
+        return result;
+    }
+
+    // spreads the lower 21 bits of value so there are two zero bits between each of them
+    static uint64_t expandBits(uint64_t value) {
+        value &= 0x1fffff;
+        value = (value | value << 32) & 0x1f00000000ffff;
+        value = (value | value << 16) & 0x1f0000ff0000ff;
+        value = (value | value << 8) & 0x100f00f00f00f00f;
+        value = (value | value << 4) & 0x10c30c30c30c30c3;
+        value = (value | value << 2) & 0x1249249249249249;
+        return value;
+    }
+
+    // 63 bit Morton code of a point in the unit cube
+    static uint64_t getMortonCode(const glm::vec3& point) {
+        const glm::vec3 scaled = glm::clamp(point * 2097151.0f, glm::vec3(0.0f), glm::vec3(2097151.0f));
+        return (expandBits(uint64_t(scaled.x)) << 2) | (expandBits(uint64_t(scaled.y)) << 1) | expandBits(uint64_t(scaled.z));
+    }
+
+    // orders the instances along a Morton curve through the centers of their world bounds, builders make tighter trees from coherent input
+    void sortByMortonCode() {
+        const VkAccelerationStructureInstanceNV* instanceData = instances.data();
+        const uint32_t instanceCount = instances.size();
+
+        if (instanceCount < 2) return;
+
+        std::vector<glm::vec3> centers(instanceCount);
+        glm::vec3 sceneMin(FLT_MAX), sceneMax(-FLT_MAX);
+
+        for (uint32_t i = 0; i < instanceCount; i++) {
+            const Bounds bounds = transformBounds(getBounds(instanceData[i].accelerationStructureReference), instanceData[i].transform);
+
+            centers[i] = (bounds.min + bounds.max) * 0.5f;
+            sceneMin = glm::min(sceneMin, centers[i]);
+            sceneMax = glm::max(sceneMax, centers[i]);
+        }
+
+        const glm::vec3 sceneExtent = glm::max(sceneMax - sceneMin, glm::vec3(FLT_MIN));
+
+        std::vector<uint64_t> codes(instanceCount);
+
+        for (uint32_t i = 0; i < instanceCount; i++) {
+            codes[i] = getMortonCode((centers[i] - sceneMin) / sceneExtent);
+        }
+
+        instances.sort(codes);
+    }
+
+    VkAccelerationStructureInstanceNV createInstance(uint64_t reference, const float* transform) const {
+        VkAccelerationStructureInstanceNV instance;
+        std::memcpy(&instance.transform, transform, sizeof(VkTransformMatrixKHR));
+        initInstance(reference, instance);
+
+        return instance;
+    }
+
+    // fills in everything but the transform, which is expected to be set already
+    void initInstance(uint64_t reference, VkAccelerationStructureInstanceNV& instance) const {
+        instance.instanceCustomIndex = 0;
+        instance.mask = 0xff;
+        instance.instanceShaderBindingTableRecordOffset = 0;
+        instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_CULL_DISABLE_BIT_NV;
+        instance.accelerationStructureReference = reference;
+
+        applyPositionDecode(reference, instance.transform);
+    }
+
+    Mesh& getMesh(uint64_t handle) {
+        auto it = bottomLevels.find(handle);
+
+        if (it == bottomLevels.end()) {
+            throw std::runtime_error("invalid mesh handle");
+        }
+
+        return it->second;
+    }
+
+    // replaces the compactable structures with tightly sized copies using the sizes written to queryPool
+    void compact(std::vector<BottomLevelAS>& blases, const std::vector<uint32_t>& compactable, VkQueryPool queryPool) {
+        const uint32_t count = static_cast<uint32_t>(compactable.size());
+
+        std::vector<VkDeviceSize> compactedSizes(count);
+        vkGetQueryPoolResults(device.device, queryPool, 0, count, sizeof(VkDeviceSize) * count, compactedSizes.data(), 
+            sizeof(VkDeviceSize), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+
+        std::vector<BottomLevelAS> compacted(count);
+
+        for (uint32_t i = 0; i < count; i++) {
+            VkAccelerationStructureCreateInfoNV createInfo{};
+            createInfo.sType = VkStructureType::VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_NV;
+            createInfo.compactedSize = compactedSizes[i];
+            createInfo.info.sType = VkStructureType::VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_INFO_NV;
+            createInfo.info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_NV;
+
+            compacted[i].init(device.device, device.allocator, &createInfo);
+        }
+
+        auto cmdBuffer = device.beginSingleTimeCommands();
+
+        for (uint32_t i = 0; i < count; i++) {
+            compacted[i].copy(cmdBuffer, blases[compactable[i]], VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_NV);
+        }
+
+        device.endSingleTimeCommands(cmdBuffer);
+
+        for (uint32_t i = 0; i < count; i++) {
+            blases[compactable[i]].destroy(device.device, device.allocator);
+            blases[compactable[i]] = compacted[i];
+        }
+    }
+
+    // creates a host visible buffer that stays mapped, used to move serialized structures in and out of the mesh cache
+    void* createMappedBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, VkBuffer& buffer, VmaAllocation& alloc) {
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = size;
+        bufferInfo.usage = usage;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        VmaAllocationCreateInfo allocCreateInfo{};
+        allocCreateInfo.usage = memoryUsage;
+        allocCreateInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+        VmaAllocationInfo allocInfo;
+
+        if (vmaCreateBuffer(device.allocator, &bufferInfo, &allocCreateInfo, &buffer, &alloc, &allocInfo) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create mapped buffer");
+        }
+
+        return allocInfo.pMappedData;
+    }
+
+    // returns the serialized structure of a mesh if the driver can still deserialize it, incompatible blobs are dropped
+    const std::vector<uint8_t>* findCachedMesh(uint64_t hash) {
+        const std::vector<uint8_t>* blob = meshCache.find(hash);
+
+        if (blob == nullptr) return nullptr;
+
+        if (blob->size() >= serializedHeaderSize) {
+            VkAccelerationStructureVersionInfoKHR versionInfo{};
+            versionInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_VERSION_INFO_KHR;
+            versionInfo.pVersionData = blob->data();
+
+            VkAccelerationStructureCompatibilityKHR compatibility = VK_ACCELERATION_STRUCTURE_COMPATIBILITY_INCOMPATIBLE_KHR;
+            vk_khr_acceleration_structure::vkGetDeviceAccelerationStructureCompatibilityKHR(device.device, &versionInfo, &compatibility);
+
+            if (compatibility == VK_ACCELERATION_STRUCTURE_COMPATIBILITY_COMPATIBLE_KHR) {
+                return blob;
+            }
+        }
+
+        meshCache.erase(hash);
+        return nullptr;
+    }
+
+    // recreates the structures of cached meshes from their serialized blobs, instead of building them
+    void restoreMeshes(const std::vector<const std::vector<uint8_t>*>& blobs, uint64_t* handles) {
+        const size_t count = blobs.size();
+
+        std::vector<VkDeviceSize> offsets(count);
+        VkDeviceSize totalSize = 0;
+
+        for (size_t i = 0; i < count; i++) {
+            offsets[i] = totalSize;
+            totalSize = alignUp(totalSize + blobs[i]->size(), serializedAlignment);
+        }
+
+        VkBuffer uploadBuffer;
+        VmaAllocation uploadAlloc;
+        auto* uploadData = static_cast<uint8_t*>(createMappedBuffer(totalSize, GetBuildInputUsage(), VMA_MEMORY_USAGE_CPU_TO_GPU, uploadBuffer, uploadAlloc));
+
+        std::vector<BottomLevelAS> blases(count);
+
+        for (size_t i = 0; i < count; i++) {
+            std::memcpy(uploadData + offsets[i], blobs[i]->data(), blobs[i]->size());
+
+            // the header stores the size the structure needs after deserializing
+            VkDeviceSize deserializedSize;
+            std::memcpy(&deserializedSize, blobs[i]->data() + 2 * VK_UUID_SIZE + sizeof(uint64_t), sizeof(deserializedSize));
+
+            VkAccelerationStructureCreateInfoNV createInfo{};
+            createInfo.sType = VkStructureType::VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_NV;
+            createInfo.compactedSize = deserializedSize;
+            createInfo.info.sType = VkStructureType::VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_INFO_NV;
+            createInfo.info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_NV;
+
+            blases[i].init(device.device, device.allocator, &createInfo);
+        }
+
+        vmaFlushAllocation(device.allocator, uploadAlloc, 0, VK_WHOLE_SIZE);
+
+        const VkDeviceAddress uploadAddress = GetBufferAddress(device.device, uploadBuffer);
+
+        auto cmdBuffer = device.beginSingleTimeCommands();
+
+        for (size_t i = 0; i < count; i++) {
+            blases[i].deserialize(cmdBuffer, uploadAddress + offsets[i]);
+        }
+
+        device.endSingleTimeCommands(cmdBuffer);
+
+        vmaDestroyBuffer(device.allocator, uploadBuffer, uploadAlloc);
+
+        for (size_t i = 0; i < count; i++) {
+            Mesh mesh;
+            mesh.blas = blases[i];
+            mesh.buildSize = blases[i].allocInfo.size;
+
+            handles[i] = nextMeshHandle++;
+            bottomLevels.emplace(handles[i], mesh);
+        }
+    }
+
+    // serializes freshly built meshes into the mesh cache
+    void storeMeshes(const std::vector<uint64_t>& handles, const std::vector<uint64_t>& hashes) {
+        const uint32_t count = static_cast<uint32_t>(handles.size());
+
+        std::vector<const BottomLevelAS*> structures(count);
+
+        for (uint32_t i = 0; i < count; i++) {
+            structures[i] = &getMesh(handles[i]).blas;
+        }
+
+        VkQueryPoolCreateInfo queryPoolInfo{};
+        queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolInfo.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR;
+        queryPoolInfo.queryCount = count;
+
+        VkQueryPool queryPool;
+
+        if (vkCreateQueryPool(device.device, &queryPoolInfo, nullptr, &queryPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create serialization size query pool");
+        }
+
+        auto cmdBuffer = device.beginSingleTimeCommands();
+
+        vkCmdResetQueryPool(cmdBuffer, queryPool, 0, count);
+        AccelerationStructureBarrier(cmdBuffer);
+        BottomLevelAS::writeProperties(cmdBuffer, structures, VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR, queryPool);
+
+        device.endSingleTimeCommands(cmdBuffer);
+
+        std::vector<VkDeviceSize> sizes(count);
+        vkGetQueryPoolResults(device.device, queryPool, 0, count, sizeof(VkDeviceSize) * count, sizes.data(), 
+            sizeof(VkDeviceSize), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+
+        vkDestroyQueryPool(device.device, queryPool, nullptr);
+
+        std::vector<VkDeviceSize> offsets(count);
+        VkDeviceSize totalSize = 0;
+
+        for (uint32_t i = 0; i < count; i++) {
+            offsets[i] = totalSize;
+            totalSize = alignUp(totalSize + sizes[i], serializedAlignment);
+        }
+
+        VkBuffer readbackBuffer;
+        VmaAllocation readbackAlloc;
+        auto* readbackData = static_cast<const uint8_t*>(createMappedBuffer(totalSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, 
+            VMA_MEMORY_USAGE_GPU_TO_CPU, readbackBuffer, readbackAlloc));
+
+        const VkDeviceAddress readbackAddress = GetBufferAddress(device.device, readbackBuffer);
+
+        cmdBuffer = device.beginSingleTimeCommands();
+
+        for (uint32_t i = 0; i < count; i++) {
+            structures[i]->serialize(cmdBuffer, readbackAddress + offsets[i]);
+        }
+
+        GlobalMemoryBarrier(cmdBuffer, VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_NV | VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV, VK_PIPELINE_STAGE_HOST_BIT);
+
+        device.endSingleTimeCommands(cmdBuffer);
+
+        vmaInvalidateAllocation(device.allocator, readbackAlloc, 0, VK_WHOLE_SIZE);
+
+        for (uint32_t i = 0; i < count; i++) {
+            meshCache.store(hashes[i], std::vector<uint8_t>(readbackData + offsets[i], readbackData + offsets[i] + sizes[i]));
+        }
+
+        vmaDestroyBuffer(device.allocator, readbackBuffer, readbackAlloc);
+    }
+
+    static bool hasShadowProxy(const MeshDescription& mesh) {
+        return mesh.shadowProxyRatio < 1.0f || mesh.shadowProxyError > 0.0f;
+    }
+
+    bool compressInputs() const {
+        return inputCompression && compressedFormat != VK_FORMAT_UNDEFINED;
+    }
+
+    // prepared meshes hold nothing but tightly packed positions, with input compression in 16 bits per component and 16 bit indices if they fit
+    BufferDescription getPreparedLayout(const MeshDescription& mesh) const {
+        BufferDescription layout;
+        layout.vertexOffset = 0;
+        layout.vertexStride = sizeof(float) * 3;
+        layout.vertexFormat = VertexFormat::R32G32B32_SFLOAT;
+        layout.indexFormat = attribDesc.indexFormat;
+
+        if (compressInputs()) {
+            // the fourth component pads the vertex to 8 bytes, it's ignored by the three component format on NV
+            layout.vertexStride = 4 * sizeof(uint16_t);
+            layout.vertexFormat = static_cast<VertexFormat>(compressedFormat);
+
+            if (mesh.vertexCount <= UINT16_MAX) {
+                layout.indexFormat = IndexFormat::UINT16;
+            }
+        }
+
+        return layout;
+    }
+
+    std::vector<BufferDescription> getPreparedLayouts(const MeshDescription* meshes, size_t count) const {
+        std::vector<BufferDescription> layouts(count);
+
+        for (size_t i = 0; i < count; i++) {
+            layouts[i] = getPreparedLayout(meshes[i]);
+        }
+
+        return layouts;
+    }
+
+    // picks the format compressed positions are encoded in, SNORM spreads the precision evenly over the bounds
+    void selectCompressedFormat() {
+        // VK_NV_ray_tracing accepts three component SNORM16 on every device
+        if (!vk_khr_acceleration_structure::enabled) {
+            compressedFormat = VK_FORMAT_R16G16B16_SNORM;
+            return;
+        }
+
+        for (VkFormat format : { VK_FORMAT_R16G16B16A16_SNORM, VK_FORMAT_R16G16B16A16_SFLOAT }) {
+            VkFormatProperties properties;
+            vkGetPhysicalDeviceFormatProperties(device.physicalDevice, format, &properties);
+
+            if (properties.bufferFeatures & VK_FORMAT_FEATURE_ACCELERATION_STRUCTURE_VERTEX_BUFFER_BIT_KHR) {
+                compressedFormat = format;
+                return;
+            }
+        }
+
+        // meshes keep full precision
+        compressedFormat = VK_FORMAT_UNDEFINED;
+    }
+
+    // returns descriptions of the meshes that point into prepared, laid out as described by getPreparedLayout
+    const MeshDescription* prepareMeshes(const MeshDescription* meshes, size_t count, std::vector<MeshDescription>& descriptions, std::vector<PreparedMesh>& prepared) {
+        descriptions.assign(meshes, meshes + count);
+        prepared.resize(count);
+
+        for (size_t i = 0; i < count; i++) {
+            prepareMesh(meshes[i], prepared[i], descriptions[i]);
+        }
+
+        return descriptions.data();
+    }
+
+    // the build only reads positions, so they are extracted from the vertices, welded and stripped of triangles without an area.
+    // Every submesh is prepared on its own, so it keeps its range, its opacity and indices that fit the index format
+    void prepareMesh(const MeshDescription& mesh, PreparedMesh& prepared, MeshDescription& result) {
+        std::vector<float> positions(size_t(mesh.vertexCount) * 3);
+        extractPositions(attribDesc.vertexFormat, static_cast<const uint8_t*>(mesh.vertices) + attribDesc.vertexOffset, attribDesc.vertexStride, mesh.vertexCount, positions.data());
+
+        std::vector<SubmeshDescription> ranges(mesh.submeshes, mesh.submeshes + mesh.submeshCount);
+
+        if (ranges.empty()) {
+            SubmeshDescription whole;
+            whole.indexCount = mesh.indexCount;
+            ranges.push_back(whole);
+        }
+
+        std::vector<uint32_t> rangeIndices;
+        std::vector<float> rangePositions;
+        SimplifiedMesh simplified;
+        std::vector<uint32_t> indices;
+
+        for (const SubmeshDescription& range : ranges) {
+            rangeIndices.resize(range.indexCount);
+
+            for (uint32_t i = 0; i < range.indexCount; i++) {
+                rangeIndices[i] = range.vertexOffset + readIndex(mesh.indices, size_t(range.indexOffset) + i);
+
+                if (rangeIndices[i] >= mesh.vertexCount) {
+                    throw std::runtime_error("index out of range");
+                }
+            }
+
+            weldPositions(positions.data(), mesh.vertexCount, rangeIndices, rangePositions);
+            rangeIndices.resize(removeDegenerateTriangles(rangePositions, rangeIndices.data(), rangeIndices.size()));
+
+            if (hasShadowProxy(mesh)) {
+                const size_t triangleCount = rangeIndices.size() / 3;
+                const size_t targetIndexCount = mesh.shadowProxyRatio < 1.0f ? std::max<size_t>(size_t(triangleCount * mesh.shadowProxyRatio), 1) * 3 : 0;
+
+                simplifyMesh(rangePositions.data(), rangePositions.size() / 3, rangeIndices.data(), rangeIndices.size(), targetIndexCount, mesh.shadowProxyError, simplified);
+
+                rangePositions.swap(simplified.positions);
+                rangeIndices.swap(simplified.indices);
+            }
+
+            SubmeshDescription submesh = range;
+            submesh.vertexOffset = static_cast<unsigned int>(prepared.positions.size() / 3);
+            submesh.indexOffset = static_cast<unsigned int>(indices.size());
+            submesh.indexCount = static_cast<unsigned int>(rangeIndices.size());
+            prepared.submeshes.push_back(submesh);
+
+            prepared.positions.insert(prepared.positions.end(), rangePositions.begin(), rangePositions.end());
+            indices.insert(indices.end(), rangeIndices.begin(), rangeIndices.end());
+        }
+
+        result.vertexCount = static_cast<unsigned int>(prepared.positions.size() / 3);
+        result.indexCount = static_cast<unsigned int>(indices.size());
+        result.submeshes = mesh.submeshCount > 0 ? prepared.submeshes.data() : nullptr;
+
+        const BufferDescription layout = getPreparedLayout(result);
+
+        prepared.indices.resize(indices.size() * getIndexSize(layout.indexFormat));
+
+        for (size_t i = 0; i < indices.size(); i++) {
+            writeIndex(layout.indexFormat, prepared.indices.data(), i, indices[i]);
+        }
+
+        result.indices = prepared.indices.data();
+        result.vertices = prepared.positions.data();
+
+        Bounds& bounds = prepared.bounds;
+        bounds.min = glm::vec3(FLT_MAX);
+        bounds.max = glm::vec3(-FLT_MAX);
+
+        for (size_t i = 0; i < result.vertexCount; i++) {
+            const glm::vec3 position(prepared.positions[i * 3], prepared.positions[i * 3 + 1], prepared.positions[i * 3 + 2]);
+            bounds.min = glm::min(bounds.min, position);
+            bounds.max = glm::max(bounds.max, position);
+        }
+
+        if (result.vertexCount == 0) {
+            bounds = Bounds();
+        }
+
+        if (layout.vertexFormat != VertexFormat::R32G32B32_SFLOAT) {
+            prepared.encoded.resize(size_t(result.vertexCount) * 4);
+            prepared.decode = encodePositions(prepared.positions.data(), result.vertexCount, compressedFormat == VK_FORMAT_R16G16B16A16_SFLOAT, prepared.encoded.data());
+            prepared.compressed = true;
+
+            result.vertices = prepared.encoded.data();
+
+            // the structure is built in the encoded space
+            const glm::vec3 scale(prepared.decode.scale[0], prepared.decode.scale[1], prepared.decode.scale[2]);
+            const glm::vec3 bias(prepared.decode.bias[0], prepared.decode.bias[1], prepared.decode.bias[2]);
+            bounds.min = (bounds.min - bias) / scale;
+            bounds.max = (bounds.max - bias) / scale;
+        }
     }
 
-    void init() {
-        device.init();
-        shaderManager.init(device.device);
-        rtx.init(device.device, device.allocator, device.physicalDevice, shaderManager);
-        rtx.createDescriptorSets(device.device, device.descriptorPool);
+    // keeps what instances of the prepared meshes need, handles to shared meshes get the same values again
+    void storePreparedMeshes(const std::vector<PreparedMesh>& prepared, const uint64_t* handles) {
+        for (size_t i = 0; i < prepared.size(); i++) {
+            const uint64_t reference = getMesh(handles[i]).blas.handle;
 
-        VkSemaphoreCreateInfo semaphoreInfo = {};
-        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            localBounds[reference] = prepared[i].bounds;
 
-        VkExportSemaphoreCreateInfo exportInfo = {};
-        exportInfo.sType = VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO;
-        exportInfo.handleTypes = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_WIN32_BIT;
+            if (prepared[i].compressed) {
+                positionDecodes[reference] = prepared[i].decode;
+            }
+        }
+    }
 
-        semaphoreInfo.pNext = &exportInfo;
+    // folds the decode of compressed positions into an instance transform, so the instance ends up where the uncompressed mesh would be
+    void applyPositionDecode(uint64_t reference, VkTransformMatrixKHR& transform) const {
+        auto it = positionDecodes.find(reference);
 
-        vkCreateSemaphore(device.device, &semaphoreInfo, nullptr, &doneSemaphore);
-        vkCreateSemaphore(device.device, &semaphoreInfo, nullptr, &readySemaphore);
+        if (it == positionDecodes.end()) return;
 
-        VkFenceCreateInfo fenceInfo{};
-        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-        fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-        vkCreateFence(device.device, &fenceInfo, nullptr, &cpuFence);
+        const PositionDecode& decode = it->second;
 
-        commandBuffers[0] = device.createCommandBuffer();
-        commandBuffers[1] = device.createCommandBuffer();
+        for (int row = 0; row < 3; row++) {
+            for (int column = 0; column < 3; column++) {
+                transform.matrix[row][3] += transform.matrix[row][column] * decode.bias[column];
+                transform.matrix[row][column] *= decode.scale[column];
+            }
+        }
     }
 
-    // vertex input API
+    uint32_t readIndex(const void* indices, size_t i) const {
+        if (attribDesc.indexFormat == IndexFormat::UINT16) {
+            return static_cast<const uint16_t*>(indices)[i];
+        }
 
-    void setVertexStride(uint32_t stride) { attribDesc.vertexStride = stride; }
+        return static_cast<const uint32_t*>(indices)[i];
+    }
 
-    void setVertexOffset(uint32_t offset) { attribDesc.vertexOffset = offset; }
+    static void writeIndex(IndexFormat format, void* indices, size_t i, uint32_t index) {
+        if (format == IndexFormat::UINT16) {
+            static_cast<uint16_t*>(indices)[i] = static_cast<uint16_t>(index);
+        } else {
+            static_cast<uint32_t*>(indices)[i] = index;
+        }
+    }
 
-    void setVertexFormat(VertexFormat format) { attribDesc.vertexFormat = format; }
+    static uint32_t getTriangleCount(const MeshDescription& mesh) {
+        if (mesh.submeshCount == 0) return mesh.indexCount / 3;
 
-    void setIndexFormat(IndexFormat format) { attribDesc.indexFormat = format; }
+        uint32_t triangleCount = 0;
 
-    HANDLE getShadowTextureMemoryHandle() {
-        return rtx.getShadowTextureMemoryHandle(device.device);
+        for (uint32_t i = 0; i < mesh.submeshCount; i++) {
+            triangleCount += mesh.submeshes[i].indexCount / 3;
+        }
+
+        return triangleCount;
     }
 
-    size_t getShadowTextureMemorySize() {
-        VkMemoryRequirements memRequirements;
-        vkGetImageMemoryRequirements(device.device, rtx.shadowsTexture.image, &memRequirements);
-        return memRequirements.size;
+    void storeTriangleCounts(const MeshDescription* sources, const MeshDescription* meshes, size_t count, const uint64_t* handles) {
+        for (size_t i = 0; i < count; i++) {
+            Mesh& mesh = getMesh(handles[i]);
+            mesh.sourceTriangleCount = getTriangleCount(sources[i]);
+            mesh.triangleCount = getTriangleCount(meshes[i]);
+        }
     }
 
-    size_t getDepthTextureMemorySize() {
-        VkMemoryRequirements memRequirements;
-        vkGetImageMemoryRequirements(device.device, rtx.depthTexture.image, &memRequirements);
-        return memRequirements.size;
+    // keeps the geometry buffer of an upload for its batchable meshes, returns false if it has none and the buffer can be released
+    bool retainGeometry(const MeshDescription* meshes, size_t count, const MeshUpload& upload) {
+        VulkanBuffer geometryBuffer = upload.geometryBuffer;
+        size_t firstGeometry = 0;
+        uint32_t refCount = 0;
+
+        for (size_t i = 0; i < count; i++) {
+            const size_t geometryCount = std::max(meshes[i].submeshCount, 1u);
+
+            if (meshes[i].batchable) {
+                RetainedGeometry& retained = retainedGeometry[upload.blases[i].handle];
+                retained.buffer = geometryBuffer.getBuffer();
+                retained.geometries.assign(upload.geometries.begin() + firstGeometry, upload.geometries.begin() + firstGeometry + geometryCount);
+                refCount++;
+            }
+
+            firstGeometry += geometryCount;
+        }
+
+        if (refCount == 0) return false;
+
+        RetainedBuffer& retained = retainedBuffers[geometryBuffer.getBuffer()];
+        retained.buffer = geometryBuffer;
+        retained.refCount = refCount;
+
+        return true;
     }
 
-    HANDLE getReadySemaphoreHandle() {
-        auto vkGetSemaphoreWin32HandleKHR = PFN_vkGetSemaphoreWin32HandleKHR(vkGetDeviceProcAddr(device.device, "vkGetSemaphoreWin32HandleKHR"));
+    // drops the geometry of a batchable mesh, the buffer is released with the last mesh in it
+    void releaseGeometry(uint64_t reference) {
+        auto it = retainedGeometry.find(reference);
 
-        HANDLE handle;
+        if (it == retainedGeometry.end()) return;
 
-        VkSemaphoreGetWin32HandleInfoKHR info = {};
-        info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_WIN32_HANDLE_INFO_KHR;
-        info.semaphore = readySemaphore;
-        info.handleType = VkExternalSemaphoreHandleTypeFlagBits::VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_WIN32_BIT;
+        auto buffer = retainedBuffers.find(it->second.buffer);
 
-        if (vkGetSemaphoreWin32HandleKHR(device.device, &info, &handle) != VK_SUCCESS) {
-            throw std::runtime_error("failed to export semaphore");
+        if (--buffer->second.refCount == 0) {
+            deletionQueue.push(submittedFrame + 1, [this, geometryBuffer = buffer->second.buffer]() mutable {
+                geometryBuffer.destroy(device);
+            });
+
+            retainedBuffers.erase(buffer);
         }
 
-        return handle;
+        retainedGeometry.erase(it);
     }
 
-    HANDLE getDoneSemaphoreHandle() {
-        auto vkGetSemaphoreWin32HandleKHR = PFN_vkGetSemaphoreWin32HandleKHR(vkGetDeviceProcAddr(device.device, "vkGetSemaphoreWin32HandleKHR"));
+    // resolves the build preference of a mesh to Vulkan flags, asynchronous builds can't be compacted
+    VkBuildAccelerationStructureFlagsNV getBuildFlags(const MeshDescription& mesh, bool allowCompaction) {
+        // SCENE_DEFAULT is a bit of its own, so combining it with other preferences still picks the scene default
+        const bool sceneDefault = static_cast<unsigned int>(mesh.buildPreference) & static_cast<unsigned int>(BuildPreference::SCENE_DEFAULT);
+        const BuildPreference preference = sceneDefault ? buildPreference : mesh.buildPreference;
 
-        HANDLE handle;
+        // only the bits of the enum are passed on, anything else would reach the driver as an undefined flag
+        const unsigned int known = static_cast<unsigned int>(BuildPreference::ALLOW_COMPACTION | BuildPreference::PREFER_FAST_TRACE |
+            BuildPreference::PREFER_FAST_BUILD | BuildPreference::LOW_MEMORY);
 
-        VkSemaphoreGetWin32HandleInfoKHR info = {};
-        info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_WIN32_HANDLE_INFO_KHR;
-        info.semaphore = doneSemaphore;
-        info.handleType = VkExternalSemaphoreHandleTypeFlagBits::VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_WIN32_BIT;
+        auto flags = static_cast<VkBuildAccelerationStructureFlagsNV>(static_cast<unsigned int>(preference) & known);
 
-        if (vkGetSemaphoreWin32HandleKHR(device.device, &info, &handle) != VK_SUCCESS) {
-            throw std::runtime_error("failed to export semaphore");
+        if (compactMeshes) {
+            flags |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_NV;
         }
 
-        return handle;
+        if (!allowCompaction) {
+            flags &= ~VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_NV;
+        }
+
+        // the two are mutually exclusive, tracing speed wins
+        if ((flags & VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_NV) && (flags & VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_NV)) {
+            flags &= ~VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_NV;
+        }
+
+        return flags;
     }
 
-    void submit(uint32_t width, uint32_t height) {
-        VkPhysicalDeviceRayTracingPropertiesNV rtProps{};
-        rtProps.sType = VkStructureType::VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PROPERTIES_NV;
+    // checked before anything is allocated, so a bad submesh doesn't leak half a batch
+    static void validateMeshes(const MeshDescription* meshes, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            if (!(meshes[i].shadowProxyRatio > 0.0f && meshes[i].shadowProxyRatio <= 1.0f) || meshes[i].shadowProxyError < 0.0f) {
+                throw std::runtime_error("shadow proxy settings out of range");
+            }
 
-        VkPhysicalDeviceProperties2 pdProps{};
-        pdProps.sType = VkStructureType::VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
-        pdProps.pNext = &rtProps;
+            for (uint32_t j = 0; j < meshes[i].submeshCount; j++) {
+                const SubmeshDescription& submesh = meshes[i].submeshes[j];
 
-        vkGetPhysicalDeviceProperties2(device.physicalDevice, &pdProps);
+                if (submesh.vertexOffset >= meshes[i].vertexCount || uint64_t(submesh.indexOffset) + submesh.indexCount > meshes[i].indexCount) {
+                    throw std::runtime_error("submesh out of range");
+                }
+            }
+        }
+    }
 
-        auto& commandBuffer = commandBuffers[activeCommandBuffer];
-        activeCommandBuffer = !activeCommandBuffer;
+    // copies the geometry to the GPU and records the bottom level builds, the caller submits and cleans up
+    // layouts holds the layout of every mesh, prepared meshes can differ in their formats
+    MeshUpload recordMeshes(VkCommandBuffer cmdBuffer, const BufferDescription* layouts, const MeshDescription* meshes, size_t count, ScratchArena& arena, VkQueryPool queryPool, 
+        const VkBuildAccelerationStructureFlagsNV* buildFlags, bool timed) {
 
-        VkCommandBufferBeginInfo beginInfo = {};
-        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        // lay out all vertex and index data back to back in a single buffer
+        std::vector<VkDeviceSize> vertexOffsets(count), indexOffsets(count);
+        VkDeviceSize geometrySize = 0;
 
-        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        for (size_t i = 0; i < count; i++) {
+            vertexOffsets[i] = geometrySize;
+            geometrySize = alignUp(geometrySize + VkDeviceSize(layouts[i].vertexStride) * meshes[i].vertexCount, 16);
+            indexOffsets[i] = geometrySize;
+            geometrySize = alignUp(geometrySize + VkDeviceSize(getIndexSize(layouts[i].indexFormat)) * meshes[i].indexCount, 16);
+        }
 
-        rtx.execute(device.device, commandBuffer, width, height, rtProps);
+        MeshUpload upload;
 
-        vkEndCommandBuffer(commandBuffer);
+        VmaAllocationInfo stagingAllocInfo;
+        std::tie(upload.stagingBuffer, upload.stagingAlloc, stagingAllocInfo) = device.createStagingBuffer(geometrySize);
 
-        // incase we're submitting faster then rendering, we wait for 
-        // previous execution to finish before proceeding with  the submit
-        vkWaitForFences(device.device, 1, &cpuFence, VK_TRUE, UINT64_MAX);
+        auto* stagingData = static_cast<uint8_t*>(stagingAllocInfo.pMappedData);
 
-        vkResetFences(device.device, 1, &cpuFence);
+        {
+            SCATTER_ZONE("copy mesh staging");
 
-        VkSubmitInfo submitInfo{};
-        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            for (size_t i = 0; i < count; i++) {
+                std::memcpy(stagingData + vertexOffsets[i], meshes[i].vertices, size_t(layouts[i].vertexStride) * meshes[i].vertexCount);
+                std::memcpy(stagingData + indexOffsets[i], meshes[i].indices, size_t(getIndexSize(layouts[i].indexFormat)) * meshes[i].indexCount);
+            }
+        }
 
-        VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_ALL_COMMANDS_BIT };
-        submitInfo.waitSemaphoreCount = 1;
-        submitInfo.pWaitSemaphores = &readySemaphore;
-        submitInfo.pWaitDstStageMask = waitStages;
+        upload.geometryBuffer.create(device, geometrySize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | GetBuildInputUsage());
 
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffer;
+        // every submesh is a geometry, meshes without submeshes are a single geometry
+        std::vector<VkGeometryNV> geometries;
+        std::vector<size_t> firstGeometry(count);
 
-        submitInfo.signalSemaphoreCount = 1;
-        submitInfo.pSignalSemaphores = &doneSemaphore;
+        for (size_t i = 0; i < count; i++) {
+            const BufferDescription& layout = layouts[i];
+            firstGeometry[i] = geometries.size();
+
+            if (meshes[i].submeshCount == 0) {
+                geometries.push_back(createGeometry(layout, upload.geometryBuffer.getBuffer(), vertexOffsets[i], meshes[i].vertexCount, indexOffsets[i], meshes[i].indexCount, true));
+                continue;
+            }
+
+            for (uint32_t j = 0; j < meshes[i].submeshCount; j++) {
+                const SubmeshDescription& submesh = meshes[i].submeshes[j];
+
+                geometries.push_back(createGeometry(layout, upload.geometryBuffer.getBuffer(), 
+                    vertexOffsets[i] + VkDeviceSize(layout.vertexStride) * submesh.vertexOffset, meshes[i].vertexCount - submesh.vertexOffset,
+                    indexOffsets[i] + VkDeviceSize(getIndexSize(layout.indexFormat)) * submesh.indexOffset, submesh.indexCount, submesh.opaque));
+            }
+        }
+
+        // create all the bottom level acceleration structures up front
+        std::vector<VkAccelerationStructureCreateInfoNV> createInfos(count);
+        upload.blases.resize(count);
+
+        std::vector<VkDeviceSize> scratchSizes(count);
+        VkDeviceSize scratchSize = 0;
+
+        for (size_t i = 0; i < count; i++) {
+            VkAccelerationStructureCreateInfoNV& BLAScreateInfo = createInfos[i];
+            BLAScreateInfo.sType = VkStructureType::VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_NV;
+            BLAScreateInfo.info.sType = VkStructureType::VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_INFO_NV;
+            BLAScreateInfo.info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_NV;
+            BLAScreateInfo.info.flags = buildFlags[i];
+            BLAScreateInfo.info.instanceCount = 0;
+            BLAScreateInfo.info.geometryCount = std::max(meshes[i].submeshCount, 1u);
+            BLAScreateInfo.info.pGeometries = &geometries[firstGeometry[i]];
+
+            upload.blases[i].init(device.device, device.allocator, &BLAScreateInfo);
+            scratchSizes[i] = upload.blases[i].getScratchSize(device.device);
+            scratchSize = std::max(scratchSize, scratchSizes[i]);
+        }
+
+        arena.reserve(device, scratchSize);
+        arena.reset();
+
+        if (queryPool != VK_NULL_HANDLE) {
+            for (uint32_t i = 0; i < count; i++) {
+                if (buildFlags[i] & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_NV) {
+                    upload.compactable.push_back(i);
+                }
+            }
+
+            vkCmdResetQueryPool(cmdBuffer, queryPool, 0, static_cast<uint32_t>(upload.compactable.size()));
+        }
+
+        VkBufferCopy copyRegion{};
+        copyRegion.size = geometrySize;
+        vkCmdCopyBuffer(cmdBuffer, upload.stagingBuffer, upload.geometryBuffer.getBuffer(), 1, &copyRegion);
+
+        GlobalMemoryBarrier(cmdBuffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_NV,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV);
+
+        // an earlier build on the same queue might still be using the scratch arena
+        AccelerationStructureBarrier(cmdBuffer);
+
+        const uint32_t scope = timed ? gpuProfiler.begin(cmdBuffer, GpuPass::BLAS_BUILD) : GpuProfiler::noScope;
+
+        for (size_t i = 0; i < count; i++) {
+            ScratchAllocation scratch;
 
-        if (vkQueueSubmit(device.graphicsQueue, 1, &submitInfo, cpuFence) != VK_SUCCESS) {
-            throw std::runtime_error("failed to submit draw command buffer! \n");
+            // builds with their own scratch range can overlap, only wait when the arena wraps around
+            if (!arena.allocate(scratchSizes[i], scratch)) {
+                AccelerationStructureBarrier(cmdBuffer);
+                arena.reset();
+                arena.allocate(scratchSizes[i], scratch);
+            }
+
+            upload.blases[i].build(device.device, cmdBuffer, &createInfos[i], scratch.buffer, scratch.offset);
+        }
+
+        gpuProfiler.end(cmdBuffer, scope);
+
+        if (queryPool != VK_NULL_HANDLE) {
+            std::vector<const BottomLevelAS*> structures(upload.compactable.size());
+
+            for (size_t i = 0; i < structures.size(); i++) {
+                structures[i] = &upload.blases[upload.compactable[i]];
+            }
+
+            AccelerationStructureBarrier(cmdBuffer);
+
+            BottomLevelAS::writeProperties(cmdBuffer, structures, BottomLevelAS::getCompactedSizeQueryType(), queryPool);
         }
+
+        upload.geometries = std::move(geometries);
+
+        return upload;
     }
 
-    void createTextures(uint32_t width, uint32_t height) {
-        VkPhysicalDeviceMemoryProperties memoryProperties;
-        vkGetPhysicalDeviceMemoryProperties(device.physicalDevice, &memoryProperties);
-        rtx.createImages(device.device, { width, height }, &memoryProperties);
-        rtx.updateImages(device.device);
+    // hashes the prepared positions and indices, so meshes that only differ in other attributes or duplicate vertices hash the same
+    uint64_t hashMesh(const MeshDescription& mesh, bool async, uint64_t seed = 0) {
+        const BufferDescription layout = getPreparedLayout(mesh);
+
+        // the layout is part of the key, the same bytes mean different geometry in another format
+        const uint64_t key[] = { uint64_t(layout.vertexFormat), uint64_t(layout.indexFormat), mesh.vertexCount, mesh.indexCount, getBuildFlags(mesh, !async) };
+        uint64_t hash = hashBytes(key, sizeof(key), seed);
+
+        hash = hashBytes(mesh.vertices, size_t(layout.vertexStride) * mesh.vertexCount, hash);
+        hash = hashBytes(mesh.indices, size_t(getIndexSize(layout.indexFormat)) * mesh.indexCount, hash);
+
+        // batchable meshes keep their geometry, so they don't share a structure with meshes that don't
+        if (mesh.batchable) {
+            const uint64_t batchable = 1;
+            hash = hashBytes(&batchable, sizeof(batchable), hash);
+        }
+
+        // the same geometry split up differently is a different structure
+        for (uint32_t i = 0; i < mesh.submeshCount; i++) {
+            const SubmeshDescription& submesh = mesh.submeshes[i];
+            const uint64_t range[] = { submesh.vertexOffset, submesh.indexOffset, submesh.indexCount, submesh.opaque };
+            hash = hashBytes(range, sizeof(range), hash);
+        }
+
+        // 0 marks meshes that aren't shared
+        return hash != 0 ? hash : 1;
     }
 
-    void destroyTextures() {
-        rtx.destroyImages(device.device);
+    // meshes that only differ by scale or offset encode to the same positions, but instances of a shared structure
+    // share its decode as well
+    uint64_t hashPreparedMesh(const MeshDescription& mesh, const PreparedMesh& prepared, bool async, uint64_t seed) {
+        if (!prepared.compressed) return hashMesh(mesh, async, seed);
+
+        // 0 marks meshes that aren't shared
+        const uint64_t hash = hashBytes(&prepared.decode, sizeof(PositionDecode), hashMesh(mesh, async, seed));
+        return hash != 0 ? hash : 1;
     }
 
-    uint64_t addMesh(void* vertices, void* indices, unsigned int vertexCount, unsigned int indexCount) {
-        VulkanBuffer vertexBuffer;
-        vertexBuffer.init(device, vertices, attribDesc.vertexStride * vertexCount, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+    MeshIdentity getMeshIdentity(const MeshDescription& mesh, const PreparedMesh& prepared, bool async) {
+        // any odd constant works, it only has to differ from the seed of the content hash
+        const uint64_t verifySeed = 0x9E3779B97F4A7C15;
 
-        uint32_t indexSize = 0;
+        const BufferDescription layout = getPreparedLayout(mesh);
 
-        switch (attribDesc.indexFormat) {
-            case IndexFormat::UINT16: {
-                indexSize = sizeof(uint16_t);
-            } break;
-            case IndexFormat::UINT32: {
-                indexSize = sizeof(uint32_t);
-            } break;
+        MeshIdentity identity;
+        identity.vertexCount = mesh.vertexCount;
+        identity.indexCount = mesh.indexCount;
+        identity.vertexFormat = layout.vertexFormat;
+        identity.indexFormat = layout.indexFormat;
+        identity.verifyHash = hashPreparedMesh(mesh, prepared, async, verifySeed);
+
+        return identity;
+    }
+
+    // only builds meshes whose geometry hasn't been seen before, duplicates get a handle to the existing structure.
+    // A hash hit whose identity doesn't match is a collision, that mesh gets a structure of its own that isn't shared
+    void deduplicate(const MeshDescription* meshes, const PreparedMesh* prepared, size_t count, uint64_t* handles, bool async) {
+        std::vector<uint64_t> hashes(count);
+        std::vector<MeshIdentity> identities(count);
+        std::vector<bool> collided(count, false);
+
+        // the unique meshes come first, followed by the collisions
+        std::vector<MeshDescription> buildList;
+        std::vector<uint64_t> uniqueHashes;
+        std::vector<size_t> uniqueIndices, collidedIndices;
+
+        for (size_t i = 0; i < count; i++) {
+            hashes[i] = hashPreparedMesh(meshes[i], prepared[i], async, 0);
+            identities[i] = getMeshIdentity(meshes[i], prepared[i], async);
+
+            auto shared = sharedMeshes.find(hashes[i]);
+            auto unique = std::find(uniqueHashes.begin(), uniqueHashes.end(), hashes[i]);
+
+            if (shared != sharedMeshes.end()) {
+                collided[i] = !(shared->second.identity == identities[i]);
+            } else if (unique != uniqueHashes.end()) {
+                collided[i] = !(identities[uniqueIndices[unique - uniqueHashes.begin()]] == identities[i]);
+            } else {
+                buildList.push_back(meshes[i]);
+                uniqueHashes.push_back(hashes[i]);
+                uniqueIndices.push_back(i);
+            }
+
+            if (collided[i]) {
+                collidedIndices.push_back(i);
+            }
         }
 
-        VulkanBuffer indexBuffer;
-        indexBuffer.init(device, indices, indexSize * indexCount, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+        for (size_t i : collidedIndices) {
+            buildList.push_back(meshes[i]);
+        }
 
-        VkGeometryNV geometry{};
-        geometry.sType = VK_STRUCTURE_TYPE_GEOMETRY_NV;
-        geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_NV;
-        geometry.flags = VK_GEOMETRY_OPAQUE_BIT_NV;
+        if (!buildList.empty()) {
+            std::vector<uint64_t> builtHandles(buildList.size());
 
-        geometry.geometry.aabbs = {};
-        geometry.geometry.aabbs.sType = { VK_STRUCTURE_TYPE_GEOMETRY_AABB_NV };
+            if (async) {
+                buildMeshesAsync(buildList.data(), buildList.size(), builtHandles.data());
+            } else {
+                buildMeshes(buildList.data(), buildList.size(), builtHandles.data());
+            }
 
-        geometry.geometry.triangles.sType = VK_STRUCTURE_TYPE_GEOMETRY_TRIANGLES_NV;
-        geometry.geometry.triangles.vertexData = vertexBuffer.getBuffer();
-        geometry.geometry.triangles.vertexOffset = attribDesc.vertexOffset;
-        geometry.geometry.triangles.vertexCount = vertexCount;
-        geometry.geometry.triangles.vertexStride = attribDesc.vertexStride;
-        geometry.geometry.triangles.vertexFormat = static_cast<VkFormat>(attribDesc.vertexFormat);
-        geometry.geometry.triangles.indexData = indexBuffer.getBuffer();
-        geometry.geometry.triangles.indexOffset = 0;
-        geometry.geometry.triangles.indexCount = indexCount;
-        geometry.geometry.triangles.indexType = static_cast<VkIndexType>(attribDesc.indexFormat);
-        geometry.geometry.triangles.transformData = VK_NULL_HANDLE;
-        geometry.geometry.triangles.transformOffset = 0;
+            for (size_t i = 0; i < uniqueHashes.size(); i++) {
+                // the handles are handed out again below, so the map only tracks the shared structure
+                auto it = bottomLevels.find(builtHandles[i]);
+                it->second.contentHash = uniqueHashes[i];
 
+                SharedMesh& shared = sharedMeshes[uniqueHashes[i]];
+                shared.mesh = it->second;
+                shared.identity = identities[uniqueIndices[i]];
 
-        // create bottom level acceleration structure 
-        VkAccelerationStructureCreateInfoNV BLAScreateInfo{};
-        BLAScreateInfo.sType = VkStructureType::VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_NV;
-        BLAScreateInfo.info.sType = VkStructureType::VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_INFO_NV;
-        BLAScreateInfo.info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_NV;
-        BLAScreateInfo.info.instanceCount = 0;
-        BLAScreateInfo.info.geometryCount = 1;
-        BLAScreateInfo.info.pGeometries = &geometry;
+                bottomLevels.erase(it);
+            }
 
-        BottomLevelAS BLAS;
-        BLAS.init(device.device, device.allocator, &BLAScreateInfo);
-        BLAS.record(device, &BLAScreateInfo);
+            // collisions keep the handle of their own build, with a content hash of 0 like meshes that aren't deduplicated
+            for (size_t i = 0; i < collidedIndices.size(); i++) {
+                handles[collidedIndices[i]] = builtHandles[uniqueHashes.size() + i];
+            }
+        }
 
-        bottomLevels.push_back(BLAS);
+        for (size_t i = 0; i < count; i++) {
+            if (collided[i]) continue;
 
-        vertexBuffer.destroy(device);
-        indexBuffer.destroy(device);
+            SharedMesh& shared = sharedMeshes[hashes[i]];
+            shared.refCount++;
 
-        return BLAS.handle;
+            handles[i] = nextMeshHandle++;
+            bottomLevels.emplace(handles[i], shared.mesh);
+        }
     }
 
-    void addInstance(uint64_t handle, float* transform) {
-        assert(transform);
+    // copies the new vertices of deformable meshes and refits their structures, followed by a refit of the top level
+    void recordVertexUpdates(VkCommandBuffer cmdBuffer, UploadBuffer& staging) {
+        SCATTER_ZONE("record vertex updates");
 
-        VkAccelerationStructureInstanceNV instance;
-        instance.instanceCustomIndex = 0;
-        instance.mask = 0xff;
-        instance.instanceShaderBindingTableRecordOffset = 0;
-        instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_CULL_DISABLE_BIT_NV;
-        instance.accelerationStructureReference = handle;
+        // the previous frame might still be refitting from the same geometry
+        GlobalMemoryBarrier(cmdBuffer, VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_NV, VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV, VK_PIPELINE_STAGE_TRANSFER_BIT);
 
-        std::memcpy(&instance.transform, transform, sizeof(VkTransformMatrixKHR));
+        VkDeviceSize scratchSize = 0;
 
-        instances.push_back(instance);
-    }
+        for (auto& [handle, offset] : vertexUpdates) {
+            DeformableMesh& deformable = deformableMeshes.at(handle);
 
-    void build() {
-        if (instances.empty()) return;
+            VkBufferCopy copyRegion{};
+            copyRegion.srcOffset = offset;
+            copyRegion.size = deformable.vertexSize;
+            vkCmdCopyBuffer(cmdBuffer, staging.getBuffer(), deformable.geometryBuffer.getBuffer(), 1, &copyRegion);
 
-        if (TLAS.as != nullptr) {
-            TLAS.destroy(device.device, device.allocator);
+            scratchSize = std::max(scratchSize, getMesh(handle).blas.getUpdateScratchSize(device.device));
         }
 
-        // create top level acceleration structure
-        VkAccelerationStructureCreateInfoNV TLAScreateInfo{};
-        TLAScreateInfo.sType = VkStructureType::VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_NV;
-        TLAScreateInfo.info.sType = VkStructureType::VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_INFO_NV;
-        TLAScreateInfo.info.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_NV;
-        TLAScreateInfo.info.instanceCount = static_cast<uint32_t>(instances.size());
+        GlobalMemoryBarrier(cmdBuffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_NV,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV);
 
-        TLAS.init(device.device, device.allocator, &TLAScreateInfo);
-        TLAS.record(device, instances.data(), &TLAScreateInfo);
-        rtx.updateTLAS(device.device, TLAS.as);
-    }
+        // the refits of submit count towards the refit limit too, once it's reached the structure is rebuilt in place
+        const bool rebuildTLAS = TLASrefitCount >= TLASrefitLimit;
 
-    void destroyMesh(uint64_t handle) {
-        if (bottomLevels.empty()) return;
+        if (TLAS.isBuilt()) {
+            scratchSize = std::max(scratchSize, rebuildTLAS ? TLAS.getScratchSize(device.device) : TLAS.getUpdateScratchSize(device.device));
+        }
 
-        auto it = std::find_if(bottomLevels.begin(), bottomLevels.end(), [&](auto& blas) -> bool {
-            return blas.handle == handle;
-        });
+        scratchArena.reserve(device, scratchSize);
+        scratchArena.reset();
 
-        if (it != bottomLevels.end()) {
-            it->destroy(device.device, device.allocator);
-            bottomLevels.erase(it);
+        // a top level build might still be using the scratch arena
+        AccelerationStructureBarrier(cmdBuffer);
+
+        const uint32_t refitScope = gpuProfiler.begin(cmdBuffer, GpuPass::BLAS_BUILD);
+
+        for (auto& [handle, offset] : vertexUpdates) {
+            DeformableMesh& deformable = deformableMeshes.at(handle);
+            BottomLevelAS& blas = getMesh(handle).blas;
+
+            VkAccelerationStructureCreateInfoNV createInfo = getDeformableCreateInfo(deformable);
+
+            const VkDeviceSize updateScratchSize = blas.getUpdateScratchSize(device.device);
+
+            ScratchAllocation scratch;
+
+            if (!scratchArena.allocate(updateScratchSize, scratch)) {
+                AccelerationStructureBarrier(cmdBuffer);
+                scratchArena.reset();
+                scratchArena.allocate(updateScratchSize, scratch);
+            }
+
+            blas.update(device.device, cmdBuffer, &createInfo, scratch.buffer, scratch.offset);
+        }
+
+        gpuProfiler.end(cmdBuffer, refitScope);
+
+        vertexUpdates.clear();
+
+        AccelerationStructureBarrier(cmdBuffer);
+
+        // the bounds of the instances changed with their meshes
+        if (TLAS.isBuilt()) {
+            VkAccelerationStructureCreateInfoNV TLAScreateInfo = getTopLevelCreateInfo(static_cast<uint32_t>(TLASreferences.size()));
+
+            scratchArena.reset();
+
+            ScratchAllocation scratch;
+            scratchArena.allocate(rebuildTLAS ? TLAS.getScratchSize(device.device) : TLAS.getUpdateScratchSize(device.device), scratch);
+
+            // the previous frame's trace might still read the structure that is refit in place
+            TraceToBuildBarrier(cmdBuffer);
+
+            const uint32_t scope = gpuProfiler.begin(cmdBuffer, GpuPass::TLAS_BUILD);
+            TLAS.refit(device.device, cmdBuffer, &TLAScreateInfo, scratch.buffer, scratch.offset, submittedFrame + 1, !rebuildTLAS);
+            gpuProfiler.end(cmdBuffer, scope);
+
+            TLASrefitCount = rebuildTLAS ? 0 : TLASrefitCount + 1;
         }
     }
 
-    void clearInstances() {
-        instances.clear();
+    VkAccelerationStructureCreateInfoNV getDeformableCreateInfo(DeformableMesh& deformable) {
+        VkAccelerationStructureCreateInfoNV createInfo{};
+        createInfo.sType = VkStructureType::VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_NV;
+        createInfo.info.sType = VkStructureType::VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_INFO_NV;
+        createInfo.info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_NV;
+        createInfo.info.flags = deformableBuildFlags;
+        createInfo.info.geometryCount = static_cast<uint32_t>(deformable.geometries.size());
+        createInfo.info.pGeometries = deformable.geometries.data();
+        return createInfo;
     }
 
-    HANDLE getDepthTextureMemoryhandle() {
-        return rtx.getDepthTextureMemoryHandle(device.device);
+    // updates require the exact same info as the initial build
+    static VkAccelerationStructureCreateInfoNV getTopLevelCreateInfo(uint32_t instanceCount) {
+        VkAccelerationStructureCreateInfoNV createInfo{};
+        createInfo.sType = VkStructureType::VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_NV;
+        createInfo.info.sType = VkStructureType::VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_INFO_NV;
+        createInfo.info.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_NV;
+        createInfo.info.flags = VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_NV;
+        createInfo.info.instanceCount = instanceCount;
+        return createInfo;
     }
 
-    void destroy() {
+    // polls the mesh timeline, releases finished uploads and returns the last completed value
+    uint64_t updateMeshes() {
+        uint64_t completedValue = 0;
+        vkGetSemaphoreCounterValue(device.device, meshSemaphore, &completedValue);
 
-        shaderManager.destroy();
-        for (auto& blas : bottomLevels) {
-            blas.destroy(device.device, device.allocator);
-        }
+        meshUploads.collect(completedValue);
 
-        TLAS.destroy(device.device, device.allocator);
+        for (auto it = pendingMeshes.begin(); it != pendingMeshes.end();) {
+            if (it->second <= completedValue) {
+                it = pendingMeshes.erase(it);
+            } else {
+                ++it;
+            }
+        }
 
-        rtx.destroy(device.device, device.allocator, device.descriptorPool);
+        return completedValue;
+    }
 
-        vkFreeCommandBuffers(device.device, device.commandPool, commandBuffers.size(), commandBuffers.data());
+    // the previous frame and any build queued since may still reference the structure,
+    // so it is released once the next submitted frame has retired
+    template<typename AccelStructure>
+    void deferDestroy(const AccelStructure& accelStructure) {
+        // only the handles are kept, a copy of a top level would carry its instance slots and callbacks along.
+        // Both levels release them the same way
+        BottomLevelAS handles{};
+        handles.as = accelStructure.as;
+        handles.asKHR = accelStructure.asKHR;
+        handles.buffer = accelStructure.buffer;
+        handles.alloc = accelStructure.alloc;
+
+        deletionQueue.push(submittedFrame + 1, [this, handles]() mutable {
+            handles.destroy(device.device, device.allocator);
+        });
+    }
 
-        vkDestroyFence(device.device, cpuFence, nullptr);
+    bool hasSameTopology(const VkAccelerationStructureInstanceNV* instanceData, uint32_t instanceCount) {
+        if (instanceCount != TLASreferences.size()) return false;
 
-        vkDestroySemaphore(device.device, readySemaphore, nullptr);
-        vkDestroySemaphore(device.device, doneSemaphore, nullptr);
+        for (uint32_t i = 0; i < instanceCount; i++) {
+            if (instanceData[i].accelerationStructureReference != TLASreferences[i]) {
+                return false;
+            }
+        }
 
-        device.destroy();
+        return true;
     }
 
-
-private:
-    VkFence cpuFence;
     VulkanDevice device;
     RayTracedShadowsSequence rtx;
     VulkanShaderManager shaderManager;
     VkSemaphore readySemaphore, doneSemaphore;
+    bool timelineSemaphores = false;
+
+    // ring of frames in flight, submit only blocks once all of them are
+    uint32_t framesInFlight = 2;
+    std::vector<FrameSlot> frames;
+    uint32_t activeFrame = 0;
+    GpuProfiler gpuProfiler;
 
-    unsigned int activeCommandBuffer = 0;
-    std::array<VkCommandBuffer, 2> commandBuffers;
+    // recorded traces are submitted as is until the extent, the images or the TLAS change
+    uint64_t shadowVersion = 1;
+    VkPhysicalDeviceRayTracingPropertiesNV rtProps{};
+
+    // number of frames handed to the queue, resources are tagged with the frame that last used them
+    uint64_t submittedFrame = 0;
+    uint64_t completedFrame = 0;
+    DeletionQueue deletionQueue;
 
     // geometry stuff
     BufferDescription attribDesc;
-    std::vector<BottomLevelAS> bottomLevels;
+    bool compactMeshes = false;
+    BuildPreference buildPreference = BuildPreference::NONE;
+    bool deduplicateMeshes = false;
+    bool inputCompression = false;
+    VkFormat compressedFormat = VK_FORMAT_UNDEFINED;
+    std::unordered_map<uint64_t, PositionDecode> positionDecodes;
+    std::unordered_map<uint64_t, SharedMesh> sharedMeshes;
+    MeshCache meshCache;
+
+    // serialized structures start with two uuids, followed by the serialized size, the deserialized size and the handle count
+    static constexpr size_t serializedHeaderSize = 2 * VK_UUID_SIZE + 3 * sizeof(uint64_t);
+    static constexpr VkDeviceSize serializedAlignment = 256;
+    uint64_t nextMeshHandle = 1;
+    std::unordered_map<uint64_t, Mesh> bottomLevels;
     TopLevelAS TLAS;
-    std::vector< VkAccelerationStructureInstanceNV> instances;
+    ScratchArena scratchArena;
+    uint32_t TLASrefitCount = 0;
+    uint32_t TLASrefitLimit = 16;
+    std::vector<uint64_t> TLASreferences;
+    InstanceMap instances;
+    bool sortInstances = false;
+    std::unordered_map<uint64_t, Bounds> localBounds;
+
+    // asynchronous mesh uploads, tracked by the value they signal on the mesh timeline
+    VkSemaphore meshSemaphore;
+    uint64_t meshSubmitValue = 0;
+    ScratchArena meshScratchArena;
+    DeletionQueue meshUploads;
+    std::unordered_map<uint64_t, uint64_t> pendingMeshes;
+    std::vector<VkAccelerationStructureInstanceNV> readyInstances;
+    bool skippedInstances = false;
+
+    // deformable meshes, refitted with the vertices streamed in before the next submit
+    static constexpr VkBuildAccelerationStructureFlagsNV deformableBuildFlags = 
+        VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_NV | VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_NV;
+    std::unordered_map<uint64_t, DeformableMesh> deformableMeshes;
+    std::unordered_map<uint64_t, VkDeviceSize> vertexUpdates;
+
+    // static batching, instances of batchable meshes merged into a structure per grid cell
+    static constexpr VkBuildAccelerationStructureFlagsNV staticBatchBuildFlags = 
+        VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_NV | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_NV;
+    static constexpr uint32_t maxBatchGeometries = 4096;
+    std::unordered_map<uint64_t, RetainedGeometry> retainedGeometry;
+    std::unordered_map<VkBuffer, RetainedBuffer> retainedBuffers;
+    std::unordered_set<uint64_t> staticInstances;
+    std::vector<StaticBatch> staticBatches;
 };
 
 Scatter::Scatter() : pimpl{ new Impl() } {}
 Scatter:: ~Scatter() { delete pimpl; }
 
-void Scatter::init() {
-    pimpl->init();
+void Scatter::setFramesInFlight(uint32_t count) {
+    SCATTER_ZONE("Scatter::setFramesInFlight");
+    pimpl->setFramesInFlight(count);
+}
+void Scatter::setTimelineSemaphores(bool enabled) {
+    SCATTER_ZONE("Scatter::setTimelineSemaphores");
+    pimpl->setTimelineSemaphores(enabled);
+}
+void Scatter::init(RayTracingBackend backend) {
+    SCATTER_ZONE("Scatter::init");
+    pimpl->init(backend);
+}
+
+RayTracingBackend Scatter::getBackend() {
+    SCATTER_ZONE("Scatter::getBackend");
+    return pimpl->getBackend();
 }
 
 void Scatter::setVertexStride(uint32_t stride) {
+    SCATTER_ZONE("Scatter::setVertexStride");
     pimpl->setVertexStride(stride);
 }
 void Scatter::setVertexOffset(uint32_t offset) {
+    SCATTER_ZONE("Scatter::setVertexOffset");
     pimpl->setVertexOffset(offset);
 }
 void Scatter::setVertexFormat(VertexFormat format) {
+    SCATTER_ZONE("Scatter::setVertexFormat");
     pimpl->setVertexFormat(format);
 }
 void Scatter::setIndexFormat(IndexFormat format) {
+    SCATTER_ZONE("Scatter::setIndexFormat");
     pimpl->setIndexFormat(format);
 }
 
 void Scatter::setLightDirection(float x, float y, float z) {
+    SCATTER_ZONE("Scatter::setLightDirection");
     pimpl->setLightDirection(x, y, z);
 }
 void Scatter::setInverseViewProjectionMatrix(float* matrix) {
+    SCATTER_ZONE("Scatter::setInverseViewProjectionMatrix");
     pimpl->setInverseViewProjectionMatrix(matrix);
 }
 
 void* Scatter::getShadowTextureMemoryHandle() {
+    SCATTER_ZONE("Scatter::getShadowTextureMemoryHandle");
     return pimpl->getShadowTextureMemoryHandle();
 }
 void* Scatter::getDepthTextureMemoryhandle() {
+    SCATTER_ZONE("Scatter::getDepthTextureMemoryhandle");
     return pimpl->getDepthTextureMemoryhandle();
 }
 
 size_t Scatter::getShadowTextureMemorySize() {
+    SCATTER_ZONE("Scatter::getShadowTextureMemorySize");
     return pimpl->getShadowTextureMemorySize();
 }
 
 size_t Scatter::getDepthTextureMemorySize() {
+    SCATTER_ZONE("Scatter::getDepthTextureMemorySize");
     return pimpl->getDepthTextureMemorySize();
 }
 
 void* Scatter::getReadySemaphoreHandle() {
+    SCATTER_ZONE("Scatter::getReadySemaphoreHandle");
     return pimpl->getReadySemaphoreHandle();
 }
 void* Scatter::getDoneSemaphoreHandle() {
+    SCATTER_ZONE("Scatter::getDoneSemaphoreHandle");
     return pimpl->getDoneSemaphoreHandle();
 }
 
 void Scatter::submit(uint32_t width, uint32_t height) {
+    SCATTER_ZONE("Scatter::submit");
     return pimpl->submit(width, height);
 }
+uint64_t Scatter::submit(uint32_t width, uint32_t height, uint64_t waitValue) {
+    SCATTER_ZONE("Scatter::submit");
+    return pimpl->submit(width, height, waitValue);
+}
+uint64_t Scatter::getCompletedFrame() {
+    SCATTER_ZONE("Scatter::getCompletedFrame");
+    return pimpl->getCompletedFrame();
+}
+uint32_t Scatter::getFrameLatency() {
+    SCATTER_ZONE("Scatter::getFrameLatency");
+    return pimpl->getFrameLatency();
+}
 
 void Scatter::createTextures(uint32_t width, uint32_t height) {
+    SCATTER_ZONE("Scatter::createTextures");
     pimpl->createTextures(width, height);
 }
 void Scatter::destroyTextures() {
+    SCATTER_ZONE("Scatter::destroyTextures");
     pimpl->destroyTextures();
 }
 
 // as builder API
 uint64_t Scatter::addMesh(void* vertices, void* indices, unsigned int vertexCount, unsigned int indexCount) {
+    SCATTER_ZONE("Scatter::addMesh");
     return pimpl->addMesh(vertices, indices, vertexCount, indexCount);
 }
+uint64_t Scatter::addMesh(void* vertices, void* indices, unsigned int vertexCount, unsigned int indexCount, const SubmeshDescription* submeshes, unsigned int submeshCount) {
+    SCATTER_ZONE("Scatter::addMesh");
+    return pimpl->addMesh(vertices, indices, vertexCount, indexCount, submeshes, submeshCount);
+}
+void Scatter::addMeshes(const MeshDescription* meshes, size_t count, uint64_t* handles) {
+    SCATTER_ZONE("Scatter::addMeshes");
+    pimpl->addMeshes(meshes, count, handles);
+}
+uint64_t Scatter::addMeshAsync(void* vertices, void* indices, unsigned int vertexCount, unsigned int indexCount) {
+    SCATTER_ZONE("Scatter::addMeshAsync");
+    return pimpl->addMeshAsync(vertices, indices, vertexCount, indexCount);
+}
+bool Scatter::isMeshReady(uint64_t handle) {
+    SCATTER_ZONE("Scatter::isMeshReady");
+    return pimpl->isMeshReady(handle);
+}
+void Scatter::waitMeshes() {
+    SCATTER_ZONE("Scatter::waitMeshes");
+    pimpl->waitMeshes();
+}
+void Scatter::setMeshCompaction(bool enabled) {
+    SCATTER_ZONE("Scatter::setMeshCompaction");
+    pimpl->setMeshCompaction(enabled);
+}
+void Scatter::setBuildPreference(BuildPreference preference) {
+    SCATTER_ZONE("Scatter::setBuildPreference");
+    pimpl->setBuildPreference(preference);
+}
+void Scatter::setMeshCache(const char* path) {
+    SCATTER_ZONE("Scatter::setMeshCache");
+    pimpl->setMeshCache(path);
+}
+void Scatter::setMeshDeduplication(bool enabled) {
+    SCATTER_ZONE("Scatter::setMeshDeduplication");
+    pimpl->setMeshDeduplication(enabled);
+}
+void Scatter::setInputCompression(bool enabled) {
+    SCATTER_ZONE("Scatter::setInputCompression");
+    pimpl->setInputCompression(enabled);
+}
+MeshMemoryStats Scatter::getMeshMemoryStats(uint64_t handle) {
+    SCATTER_ZONE("Scatter::getMeshMemoryStats");
+    return pimpl->getMeshMemoryStats(handle);
+}
 void Scatter::destroyMesh(uint64_t handle) {
+    SCATTER_ZONE("Scatter::destroyMesh");
     pimpl->destroyMesh(handle);
 }
-void Scatter::addInstance(uint64_t handle, float* transform) {
-    pimpl->addInstance(handle, transform);
+uint64_t Scatter::addInstance(uint64_t handle, float* transform) {
+    SCATTER_ZONE("Scatter::addInstance");
+    return pimpl->addInstance(handle, transform);
+}
+void Scatter::addInstances(const float* matrices, const uint64_t* meshes, size_t count, MatrixLayout layout, uint64_t* handles) {
+    SCATTER_ZONE("Scatter::addInstances");
+    pimpl->addInstances(matrices, meshes, count, layout, handles);
+}
+void Scatter::setInstanceTransform(uint64_t instance, float* transform) {
+    SCATTER_ZONE("Scatter::setInstanceTransform");
+    pimpl->setInstanceTransform(instance, transform);
+}
+void Scatter::removeInstance(uint64_t instance) {
+    SCATTER_ZONE("Scatter::removeInstance");
+    pimpl->removeInstance(instance);
+}
+void Scatter::markStatic(uint64_t instance) {
+    SCATTER_ZONE("Scatter::markStatic");
+    pimpl->markStatic(instance);
+}
+StaticBatchStats Scatter::bakeStatic(float cellSize) {
+    SCATTER_ZONE("Scatter::bakeStatic");
+    return pimpl->bakeStatic(cellSize);
 }
 
 void Scatter::clearInstances() {
+    SCATTER_ZONE("Scatter::clearInstances");
     pimpl->clearInstances();
 }
-void Scatter::build() {
-    pimpl->build();
+void Scatter::build(bool waitForMeshes) {
+    SCATTER_ZONE("Scatter::build");
+    pimpl->build(waitForMeshes);
+}
+
+uint64_t Scatter::addDeformableMesh(void* vertices, void* indices, unsigned int vertexCount, unsigned int indexCount) {
+    SCATTER_ZONE("Scatter::addDeformableMesh");
+    return pimpl->addDeformableMesh(vertices, indices, vertexCount, indexCount);
+}
+void Scatter::updateMeshVertices(uint64_t handle, void* vertices) {
+    SCATTER_ZONE("Scatter::updateMeshVertices");
+    pimpl->updateMeshVertices(handle, vertices);
+}
+void Scatter::setTopLevelRefitLimit(uint32_t limit) {
+    SCATTER_ZONE("Scatter::setTopLevelRefitLimit");
+    pimpl->setTopLevelRefitLimit(limit);
+}
+void Scatter::setInstanceSorting(bool enabled) {
+    SCATTER_ZONE("Scatter::setInstanceSorting");
+    pimpl->setInstanceSorting(enabled);
+}
+
+void Scatter::trimScratch() {
+    SCATTER_ZONE("Scatter::trimScratch");
+    pimpl->trimScratch();
+}
+ScratchStats Scatter::getScratchStats() {
+    SCATTER_ZONE("Scatter::getScratchStats");
+    return pimpl->getScratchStats();
+}
+
+GpuTimings Scatter::getGpuTimings() {
+    SCATTER_ZONE("Scatter::getGpuTimings");
+    return pimpl->getGpuTimings();
+}
+
+void Scatter::dumpTrace(const char* path) {
+    SCATTER_ZONE("Scatter::dumpTrace");
+    writeTrace(path);
 }
 
 void Scatter::destroy() {
+    SCATTER_ZONE("Scatter::destroy");
     pimpl->destroy();
 }
 
@@ -0,0 +1,56 @@
+#include "pch.h"
+#include "ScratchArena.h"
+#include "CpuTrace.h"
+
+namespace scatter {
+
+void ScratchArena::reserve(VulkanDevice& device, VkDeviceSize size) {
+    highWaterMark = std::max(highWaterMark, size);
+
+    if (size <= capacity) return;
+
+    if (capacity > 0) {
+        // top level builds don't block, so the old buffer might still be in use
+        waitIdle(device);
+        buffer.destroy(device);
+    }
+
+    capacity = (size + alignment - 1) & ~(alignment - 1);
+    buffer.create(device, capacity, GetScratchUsage());
+
+    head = 0;
+    growCount++;
+}
+
+bool ScratchArena::allocate(VkDeviceSize size, ScratchAllocation& allocation) {
+    if (head + size > capacity) return false;
+
+    allocation.buffer = buffer.getBuffer();
+    allocation.offset = head;
+
+    head = (head + size + alignment - 1) & ~(alignment - 1);
+    allocationCount++;
+
+    return true;
+}
+
+void ScratchArena::reset() {
+    head = 0;
+}
+
+void ScratchArena::trim(VulkanDevice& device) {
+    if (capacity > 0) {
+        waitIdle(device);
+        buffer.destroy(device);
+    }
+
+    capacity = 0;
+    head = 0;
+}
+
+void ScratchArena::waitIdle(VulkanDevice& device) {
+    SCATTER_ZONE("wait for scratch queue");
+    vkQueueWaitIdle(queue != VK_NULL_HANDLE ? queue : device.graphicsQueue);
+}
+
+} // scatter
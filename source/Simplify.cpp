@@ -0,0 +1,356 @@
+#include "pch.h"
+#include "Simplify.h"
+#include "MeshPrep.h"
+#include <queue>
+
+namespace scatter {
+
+// open borders are weighted heavily so the silhouette of a mesh doesn't shrink
+static constexpr double boundaryWeight = 10.0;
+
+// symmetric 4x4 error matrix, error(v) = v^T A v + 2 b^T v + c. The weight is the triangle area it was summed from
+struct Quadric {
+    double a00 = 0.0, a01 = 0.0, a02 = 0.0, a11 = 0.0, a12 = 0.0, a22 = 0.0;
+    double b0 = 0.0, b1 = 0.0, b2 = 0.0;
+    double c = 0.0;
+    double weight = 0.0;
+
+    void addPlane(const glm::dvec3& n, double d, double w) {
+        a00 += w * n.x * n.x; a01 += w * n.x * n.y; a02 += w * n.x * n.z;
+        a11 += w * n.y * n.y; a12 += w * n.y * n.z; a22 += w * n.z * n.z;
+        b0 += w * n.x * d; b1 += w * n.y * d; b2 += w * n.z * d;
+        c += w * d * d;
+    }
+
+    void add(const Quadric& q) {
+        a00 += q.a00; a01 += q.a01; a02 += q.a02;
+        a11 += q.a11; a12 += q.a12; a22 += q.a22;
+        b0 += q.b0; b1 += q.b1; b2 += q.b2;
+        c += q.c;
+        weight += q.weight;
+    }
+
+    double evaluate(const glm::dvec3& v) const {
+        const double error = a00 * v.x * v.x + a11 * v.y * v.y + a22 * v.z * v.z
+            + 2.0 * (a01 * v.x * v.y + a02 * v.x * v.z + a12 * v.y * v.z)
+            + 2.0 * (b0 * v.x + b1 * v.y + b2 * v.z) + c;
+
+        return std::max(error, 0.0);
+    }
+
+    // the position with the smallest error solves A v = -b, fails if A is close to singular e.g on flat areas
+    bool solve(glm::dvec3& v) const {
+        const double c00 = a11 * a22 - a12 * a12;
+        const double c01 = a02 * a12 - a01 * a22;
+        const double c02 = a01 * a12 - a02 * a11;
+        const double det = a00 * c00 + a01 * c01 + a02 * c02;
+
+        if (std::abs(det) <= 1e-12 * std::max(a00 * a11 * a22, 1e-30)) return false;
+
+        const double c11 = a00 * a22 - a02 * a02;
+        const double c12 = a01 * a02 - a00 * a12;
+        const double c22 = a00 * a11 - a01 * a01;
+
+        v.x = -(c00 * b0 + c01 * b1 + c02 * b2) / det;
+        v.y = -(c01 * b0 + c11 * b1 + c12 * b2) / det;
+        v.z = -(c02 * b0 + c12 * b1 + c22 * b2) / det;
+
+        return true;
+    }
+};
+
+struct Collapse {
+    double cost;
+    uint32_t v0, v1;
+    uint32_t version0, version1;
+    glm::dvec3 position;
+
+    bool operator>(const Collapse& other) const { return cost > other.cost; }
+};
+
+class Simplifier {
+public:
+    Simplifier(const float* positions, size_t vertexCount, const uint32_t* indices, size_t indexCount) {
+        weld(positions, vertexCount, indices, indexCount);
+        computeQuadrics();
+    }
+
+    void run(size_t targetTriangleCount, float maxError) {
+        const double maxCost = double(maxError) * maxError;
+
+        std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+
+        for (uint64_t edge : edges) {
+            heap.push(getCollapse(uint32_t(edge >> 32), uint32_t(edge & UINT32_MAX)));
+        }
+
+        std::vector<uint32_t> neighbours;
+
+        while (triangleCount > targetTriangleCount && !heap.empty()) {
+            const Collapse collapse = heap.top();
+            heap.pop();
+
+            // one of the vertices moved since the collapse was queued
+            if (removed[collapse.v0] || removed[collapse.v1] || versions[collapse.v0] != collapse.version0 || versions[collapse.v1] != collapse.version1) continue;
+
+            if (maxError > 0.0f && collapse.cost > maxCost) break;
+
+            if (flips(collapse.v0, collapse.v1, collapse.position) || flips(collapse.v1, collapse.v0, collapse.position)) continue;
+
+            const uint32_t keep = collapse.v0, remove = collapse.v1;
+
+            vertices[keep] = collapse.position;
+            quadrics[keep].add(quadrics[remove]);
+            removed[remove] = true;
+            versions[keep]++;
+
+            // triangles on the collapsed edge disappear, the others are moved over to the kept vertex
+            for (uint32_t t : vertexTriangles[remove]) {
+                if (!alive[t]) continue;
+
+                std::array<uint32_t, 3>& triangle = triangles[t];
+
+                if (triangle[0] == keep || triangle[1] == keep || triangle[2] == keep) {
+                    alive[t] = false;
+                    triangleCount--;
+                    continue;
+                }
+
+                for (uint32_t& v : triangle) {
+                    if (v == remove) v = keep;
+                }
+
+                vertexTriangles[keep].push_back(t);
+            }
+
+            vertexTriangles[remove].clear();
+
+            std::vector<uint32_t>& keepTriangles = vertexTriangles[keep];
+            keepTriangles.erase(std::remove_if(keepTriangles.begin(), keepTriangles.end(), [this](uint32_t t) { return !alive[t]; }), keepTriangles.end());
+
+            neighbours.clear();
+
+            for (uint32_t t : keepTriangles) {
+                for (uint32_t v : triangles[t]) {
+                    if (v != keep) neighbours.push_back(v);
+                }
+            }
+
+            std::sort(neighbours.begin(), neighbours.end());
+            neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+
+            for (uint32_t v : neighbours) {
+                heap.push(getCollapse(keep, v));
+            }
+        }
+    }
+
+    void write(SimplifiedMesh& result) const {
+        std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+
+        result.positions.clear();
+        result.indices.clear();
+        result.indices.reserve(triangleCount * 3);
+
+        for (size_t t = 0; t < triangles.size(); t++) {
+            if (!alive[t]) continue;
+
+            for (uint32_t v : triangles[t]) {
+                if (remap[v] == UINT32_MAX) {
+                    remap[v] = static_cast<uint32_t>(result.positions.size() / 3);
+                    result.positions.push_back(static_cast<float>(vertices[v].x));
+                    result.positions.push_back(static_cast<float>(vertices[v].y));
+                    result.positions.push_back(static_cast<float>(vertices[v].z));
+                }
+
+                result.indices.push_back(remap[v]);
+            }
+        }
+    }
+
+private:
+    // merges equal positions and drops triangles that are degenerate after merging
+    void weld(const float* positions, size_t vertexCount, const uint32_t* indices, size_t indexCount) {
+        std::vector<uint32_t> welded(indices, indices + indexCount);
+        std::vector<float> weldedPositions;
+
+        weldPositions(positions, vertexCount, welded, weldedPositions);
+
+        vertices.reserve(weldedPositions.size() / 3);
+
+        for (size_t i = 0; i + 2 < weldedPositions.size(); i += 3) {
+            vertices.emplace_back(weldedPositions[i], weldedPositions[i + 1], weldedPositions[i + 2]);
+        }
+
+        for (size_t i = 0; i + 2 < indexCount; i += 3) {
+            const std::array<uint32_t, 3> triangle = { welded[i], welded[i + 1], welded[i + 2] };
+
+            if (triangle[0] == triangle[1] || triangle[1] == triangle[2] || triangle[0] == triangle[2]) continue;
+
+            triangles.push_back(triangle);
+        }
+
+        triangleCount = triangles.size();
+        alive.assign(triangles.size(), true);
+        removed.assign(vertices.size(), false);
+        versions.assign(vertices.size(), 0);
+        quadrics.resize(vertices.size());
+        vertexTriangles.resize(vertices.size());
+
+        for (uint32_t t = 0; t < triangles.size(); t++) {
+            for (uint32_t v : triangles[t]) {
+                vertexTriangles[v].push_back(t);
+            }
+        }
+    }
+
+    void computeQuadrics() {
+        // edges keyed by their sorted vertices, counting the triangles that use them
+        std::unordered_map<uint64_t, uint32_t> edgeUse;
+
+        for (const std::array<uint32_t, 3>& triangle : triangles) {
+            const glm::dvec3& p0 = vertices[triangle[0]];
+            const glm::dvec3 normal = glm::cross(vertices[triangle[1]] - p0, vertices[triangle[2]] - p0);
+            const double length = glm::length(normal);
+
+            for (int i = 0; i < 3; i++) {
+                const uint32_t a = triangle[i], b = triangle[(i + 1) % 3];
+                edgeUse[getEdgeKey(a, b)]++;
+            }
+
+            if (length == 0.0) continue;
+
+            const glm::dvec3 n = normal / length;
+            const double area = length * 0.5;
+
+            for (uint32_t v : triangle) {
+                quadrics[v].addPlane(n, -glm::dot(n, p0), area);
+                quadrics[v].weight += area;
+            }
+        }
+
+        edges.reserve(edgeUse.size());
+
+        for (auto& [edge, count] : edgeUse) {
+            edges.push_back(edge);
+        }
+
+        // a plane through every border edge, perpendicular to its triangle
+        for (const std::array<uint32_t, 3>& triangle : triangles) {
+            const glm::dvec3& p0 = vertices[triangle[0]];
+            const glm::dvec3 normal = glm::cross(vertices[triangle[1]] - p0, vertices[triangle[2]] - p0);
+            const double length = glm::length(normal);
+
+            if (length == 0.0) continue;
+
+            for (int i = 0; i < 3; i++) {
+                const uint32_t a = triangle[i], b = triangle[(i + 1) % 3];
+
+                if (edgeUse[getEdgeKey(a, b)] != 1) continue;
+
+                const glm::dvec3 edge = vertices[b] - vertices[a];
+                const glm::dvec3 perpendicular = glm::cross(edge, normal / length);
+                const double perpendicularLength = glm::length(perpendicular);
+
+                if (perpendicularLength == 0.0) continue;
+
+                const glm::dvec3 n = perpendicular / perpendicularLength;
+                const double w = glm::dot(edge, edge) * boundaryWeight;
+
+                quadrics[a].addPlane(n, -glm::dot(n, vertices[a]), w);
+                quadrics[b].addPlane(n, -glm::dot(n, vertices[a]), w);
+            }
+        }
+    }
+
+    static uint64_t getEdgeKey(uint32_t a, uint32_t b) {
+        return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+    }
+
+    // the error is divided by the area it was summed over, so it reads as a squared distance
+    Collapse getCollapse(uint32_t v0, uint32_t v1) const {
+        Quadric q = quadrics[v0];
+        q.add(quadrics[v1]);
+
+        const double weight = std::max(q.weight, 1e-30);
+
+        Collapse collapse;
+        collapse.v0 = v0;
+        collapse.v1 = v1;
+        collapse.version0 = versions[v0];
+        collapse.version1 = versions[v1];
+
+        const glm::dvec3 candidates[] = { vertices[v0], vertices[v1], (vertices[v0] + vertices[v1]) * 0.5 };
+
+        collapse.position = candidates[0];
+        collapse.cost = q.evaluate(candidates[0]);
+
+        for (const glm::dvec3& candidate : candidates) {
+            const double cost = q.evaluate(candidate);
+
+            if (cost < collapse.cost) {
+                collapse.cost = cost;
+                collapse.position = candidate;
+            }
+        }
+
+        glm::dvec3 optimal;
+
+        if (q.solve(optimal)) {
+            const double cost = q.evaluate(optimal);
+
+            if (cost < collapse.cost) {
+                collapse.cost = cost;
+                collapse.position = optimal;
+            }
+        }
+
+        collapse.cost /= weight;
+
+        return collapse;
+    }
+
+    // whether moving v to position turns over one of its triangles that doesn't also contain other
+    bool flips(uint32_t v, uint32_t other, const glm::dvec3& position) const {
+        for (uint32_t t : vertexTriangles[v]) {
+            if (!alive[t]) continue;
+
+            const std::array<uint32_t, 3>& triangle = triangles[t];
+
+            if (triangle[0] == other || triangle[1] == other || triangle[2] == other) continue;
+
+            std::array<glm::dvec3, 3> corners = { vertices[triangle[0]], vertices[triangle[1]], vertices[triangle[2]] };
+            const glm::dvec3 before = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+
+            for (int i = 0; i < 3; i++) {
+                if (triangle[i] == v) corners[i] = position;
+            }
+
+            const glm::dvec3 after = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+
+            if (glm::dot(before, after) <= 0.0) return true;
+        }
+
+        return false;
+    }
+
+    std::vector<glm::dvec3> vertices;
+    std::vector<Quadric> quadrics;
+    std::vector<uint32_t> versions;
+    std::vector<bool> removed;
+
+    std::vector<std::array<uint32_t, 3>> triangles;
+    std::vector<bool> alive;
+    std::vector<std::vector<uint32_t>> vertexTriangles;
+    std::vector<uint64_t> edges;
+    size_t triangleCount = 0;
+};
+
+void simplifyMesh(const float* positions, size_t vertexCount, const uint32_t* indices, size_t indexCount, size_t targetIndexCount, float maxError,
+    SimplifiedMesh& result) {
+    Simplifier simplifier(positions, vertexCount, indices, indexCount);
+    simplifier.run(targetIndexCount / 3, maxError);
+    simplifier.write(result);
+}
+
+}
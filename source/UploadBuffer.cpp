@@ -0,0 +1,71 @@
+#include "pch.h"
+#include "UploadBuffer.h"
+#include "CpuTrace.h"
+
+namespace scatter {
+
+VkDeviceSize UploadBuffer::push(VulkanDevice& device, const void* data, VkDeviceSize size) {
+    SCATTER_ZONE("copy upload staging");
+
+    // copy regions only need 4 byte alignment, 16 keeps vertex data nicely aligned
+    const VkDeviceSize offset = (head + 15) & ~VkDeviceSize(15);
+
+    if (offset + size > capacity) {
+        grow(device, std::max(offset + size, capacity * 2));
+    }
+
+    std::memcpy(mapped + offset, data, size);
+    head = offset + size;
+
+    return offset;
+}
+
+void UploadBuffer::write(VkDeviceSize offset, const void* data, VkDeviceSize size) {
+    assert(offset + size <= head);
+
+    std::memcpy(mapped + offset, data, size);
+}
+
+void UploadBuffer::grow(VulkanDevice& device, VkDeviceSize size) {
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VmaAllocationCreateInfo allocCreateInfo{};
+    allocCreateInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    allocCreateInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+
+    VkBuffer newBuffer;
+    VmaAllocation newAlloc;
+    VmaAllocationInfo allocInfo;
+
+    if (vmaCreateBuffer(device.allocator, &bufferInfo, &allocCreateInfo, &newBuffer, &newAlloc, &allocInfo) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create upload buffer");
+    }
+
+    // nothing has been submitted since the last reset, so the old buffer can go right away
+    if (buffer != VK_NULL_HANDLE) {
+        std::memcpy(allocInfo.pMappedData, mapped, head);
+        vmaDestroyBuffer(device.allocator, buffer, alloc);
+    }
+
+    buffer = newBuffer;
+    alloc = newAlloc;
+    mapped = static_cast<uint8_t*>(allocInfo.pMappedData);
+    capacity = size;
+}
+
+void UploadBuffer::destroy(VulkanDevice& device) {
+    if (buffer != VK_NULL_HANDLE) {
+        vmaDestroyBuffer(device.allocator, buffer, alloc);
+    }
+
+    buffer = VK_NULL_HANDLE;
+    mapped = nullptr;
+    capacity = 0;
+    head = 0;
+}
+
+}
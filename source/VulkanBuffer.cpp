@@ -11,16 +11,7 @@ void VulkanBuffer::init(VulkanDevice& device, const void* vectorData, size_t siz
         memcpy(stagingAllocInfo.pMappedData, vectorData, sizeInBytes);
     }
 
-    VkBufferCreateInfo vertexBufferInfo{};
-    vertexBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    vertexBufferInfo.size = sizeInBytes;
-    vertexBufferInfo.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-    vertexBufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-    VmaAllocationCreateInfo allocCreateInfo{};
-    allocCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
-
-    vmaCreateBuffer(device.allocator, &vertexBufferInfo, &allocCreateInfo, &buffer, &alloc, &allocInfo);
+    create(device, sizeInBytes, usage);
 
     if (vectorData) {
         auto commandBuffer = device.beginSingleTimeCommands();
@@ -37,6 +28,21 @@ void VulkanBuffer::init(VulkanDevice& device, const void* vectorData, size_t siz
     vmaDestroyBuffer(device.allocator, stagingBuffer, stagingAlloc);
 }
 
+void VulkanBuffer::create(VulkanDevice& device, size_t sizeInBytes, uint32_t usage) {
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = sizeInBytes;
+    bufferInfo.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VmaAllocationCreateInfo allocCreateInfo{};
+    allocCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+    if (vmaCreateBuffer(device.allocator, &bufferInfo, &allocCreateInfo, &buffer, &alloc, &allocInfo) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create device local buffer");
+    }
+}
+
 void VulkanBuffer::destroy(const VulkanDevice& device) {
     vmaDestroyBuffer(device.allocator, buffer, alloc);
 }
@@ -1,8 +1,27 @@
 #include "pch.h"
 #include "HelloTriangleApplication.h"
 #include "Application.h"
+#include "Benchmark.h"
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "--benchmark") == 0) {
+        std::cout << "Scatter benchmark \n";
+        auto benchmark = scatter::Benchmark();
+
+        try {
+            benchmark.init(1920, 1080);
+            benchmark.run();
+        }
+        catch (const std::exception& e) {
+            std::cerr << "Exception occured!\n";
+            std::cerr << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        benchmark.destroy();
+        return EXIT_SUCCESS;
+    }
 
-int main() {
     HelloTriangleApplication myApp;
     myApp.wakeUpBool = false;
     if (myApp.wakeUpBool)